@@ -1,16 +1,21 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <span>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "extern/flux.hpp"
@@ -91,6 +96,274 @@ constexpr auto string_from_file = [](const char* path)
     return flux::from_istreambuf(file).template to<std::string>();
 };
 
+/*
+ * A set of ASCII letters, stored as a bitmask. Bits 1 to 26 are 'a' to 'z'
+ * and bits 27 to 52 are 'A' to 'Z'; anything else is ignored. Intersections
+ * are then a single AND, and the lowest bit set gives the first letter in
+ * that order.
+ */
+class letter_set {
+    uint64_t bits_ = 0;
+
+    constexpr explicit letter_set(uint64_t bits) : bits_(bits) {}
+
+public:
+    // The letter's bit position, or 0 for anything that isn't a letter
+    static constexpr auto index_of(char c) -> int
+    {
+        if (c >= 'a' && c <= 'z') {
+            return 1 + c - 'a';
+        } else if (c >= 'A' && c <= 'Z') {
+            return 27 + c - 'A';
+        }
+        return 0;
+    }
+
+    letter_set() = default;
+
+    constexpr explicit letter_set(flux::sequence auto&& chars)
+    {
+        flux::for_each(FLUX_FWD(chars), [this](char c) { insert(c); });
+    }
+
+    constexpr void insert(char c)
+    {
+        bits_ |= (uint64_t{1} << index_of(c)) & ~uint64_t{1};
+    }
+
+    constexpr auto contains(char c) const -> bool
+    {
+        return index_of(c) != 0 && (bits_ >> index_of(c) & 1) != 0;
+    }
+
+    constexpr auto empty() const -> bool { return bits_ == 0; }
+
+    constexpr auto size() const -> int { return std::popcount(bits_); }
+
+    // The index of the first letter in the set, or 0 if it's empty
+    constexpr auto first_index() const -> int
+    {
+        return bits_ == 0 ? 0 : std::countr_zero(bits_);
+    }
+
+    friend constexpr auto operator&(letter_set lhs, letter_set rhs) -> letter_set
+    {
+        return letter_set(lhs.bits_ & rhs.bits_);
+    }
+
+    friend constexpr auto operator|(letter_set lhs, letter_set rhs) -> letter_set
+    {
+        return letter_set(lhs.bits_ | rhs.bits_);
+    }
+
+    friend constexpr bool operator==(letter_set, letter_set) = default;
+};
+
+/*
+ * Keeps the K largest values pushed into it, in a fixed-size array.
+ *
+ * For small K the values are kept sorted, and a new value is slid into place
+ * like in an insertion sort, which beats anything cleverer when there are only
+ * a handful of values to move. For larger K they're kept in a min-heap
+ * instead, so that replacing the smallest value is O(log K).
+ */
+template <typename T, std::size_t K>
+class top_k {
+    static constexpr bool use_heap = K > 32;
+    static constexpr auto heap_cmp = std::greater<>{};
+
+    std::array<T, K> vals_{};
+    std::size_t size_ = 0;
+
+public:
+    constexpr void push(T val)
+    {
+        if constexpr (use_heap) {
+            if (size_ < K) {
+                vals_[size_++] = std::move(val);
+                std::push_heap(vals_.begin(), vals_.begin() + size_, heap_cmp);
+            } else if (vals_.front() < val) {
+                std::pop_heap(vals_.begin(), vals_.end(), heap_cmp);
+                vals_.back() = std::move(val);
+                std::push_heap(vals_.begin(), vals_.end(), heap_cmp);
+            }
+        } else {
+            std::size_t i = 0;
+            if (size_ < K) {
+                // Shift larger values up to make room
+                i = size_++;
+                for (; i > 0 && val < vals_[i - 1]; --i) {
+                    vals_[i] = std::move(vals_[i - 1]);
+                }
+            } else if (vals_.front() < val) {
+                // Drop the smallest value, shifting smaller values down
+                for (; i + 1 < K && vals_[i + 1] < val; ++i) {
+                    vals_[i] = std::move(vals_[i + 1]);
+                }
+            } else {
+                return;
+            }
+            vals_[i] = std::move(val);
+        }
+    }
+
+    constexpr void merge(top_k const& other)
+    {
+        for (T const& val : other.values()) {
+            push(val);
+        }
+    }
+
+    constexpr auto size() const -> std::size_t { return size_; }
+
+    // The values, in no particular order
+    constexpr auto values() const -> std::span<T const>
+    {
+        return {vals_.data(), size_};
+    }
+
+    // The values, smallest first (if fewer than K values have been pushed,
+    // only the first size() are meaningful)
+    constexpr auto sorted() const -> std::array<T, K>
+    {
+        auto out = vals_;
+        std::sort(out.begin(), out.begin() + size_);
+        return out;
+    }
+};
+
+// Returns the N largest elements of a sequence, smallest first
+template <std::size_t N>
+constexpr auto max_n = []<flux::sequence Seq>(Seq seq)
+{
+    top_k<flux::value_t<Seq>, N> top;
+    std::move(seq).for_each([&top](auto&& elem) { top.push(FLUX_FWD(elem)); });
+    assert(top.size() == N);
+    return flux::from(top.sorted());
+};
+
+// As max_n, but for a contiguous range of values, which are split between
+// n_threads threads. Each thread finds its own top N, and these are merged
+// at the end.
+template <std::size_t N>
+constexpr auto parallel_max_n = [](auto const& values, int n_threads)
+{
+    using T = std::ranges::range_value_t<decltype(values)>;
+    std::span<T const> all(values);
+    std::vector<top_k<T, N>> tops(std::max(n_threads, 1));
+
+    {
+        std::size_t const chunk_sz = (all.size() + tops.size() - 1) / tops.size();
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < tops.size(); t++) {
+            std::size_t const begin = std::min(t * chunk_sz, all.size());
+            std::size_t const end = std::min(begin + chunk_sz, all.size());
+            threads.emplace_back([chunk = all.subspan(begin, end - begin), &top = tops[t]] {
+                for (T const& val : chunk) {
+                    top.push(val);
+                }
+            });
+        }
+    }
+
+    for (std::size_t t = 1; t < tops.size(); t++) {
+        tops[0].merge(tops[t]);
+    }
+    assert(tops[0].size() == N);
+    return flux::from(tops[0].sorted());
+};
+
+/*
+ * Adapts a sequence into a sequence of arrays of N consecutive elements. Any
+ * elements left over at the end which don't make a whole chunk are dropped.
+ *
+ * A cursor remembers the base cursor of every element in its chunk, so
+ * reading a chunk doesn't need to walk the base sequence again, and moving
+ * to the next chunk carries on from the last element.
+ */
+template <flux::multipass_sequence Base, std::size_t N>
+struct chunk_adaptor : flux::lens_base<chunk_adaptor<Base, N>> {
+    Base base_;
+
+    constexpr explicit chunk_adaptor(Base&& base) : base_(std::move(base)) {}
+
+    struct flux_sequence_iface {
+        struct cursor_type {
+            std::array<flux::cursor_t<Base>, N> elems{};
+            bool complete = false;
+
+            friend constexpr bool operator==(cursor_type const&, cursor_type const&) = default;
+        };
+
+        static constexpr auto chunk_at(auto& self, flux::cursor_t<Base> cur) -> cursor_type
+        {
+            cursor_type chunk;
+            for (auto& elem : chunk.elems) {
+                if (flux::is_last(self.base_, cur)) {
+                    return chunk;
+                }
+                elem = cur;
+                flux::inc(self.base_, cur);
+            }
+            chunk.complete = true;
+            return chunk;
+        }
+
+        static constexpr auto first(auto& self) -> cursor_type
+        {
+            return chunk_at(self, flux::first(self.base_));
+        }
+
+        static constexpr auto is_last(auto&, cursor_type const& cur) -> bool
+        {
+            return !cur.complete;
+        }
+
+        static constexpr auto read_at(auto& self, cursor_type const& cur)
+        {
+            return [&]<std::size_t... I>(std::index_sequence<I...>) {
+                return std::array<flux::value_t<Base>, N>{flux::read_at(self.base_, cur.elems[I])...};
+            }(std::make_index_sequence<N>{});
+        }
+
+        static constexpr auto inc(auto& self, cursor_type& cur) -> cursor_type&
+        {
+            return cur = chunk_at(self, flux::next(self.base_, cur.elems.back()));
+        }
+    };
+};
+
+template <std::size_t N>
+constexpr auto chunk = []<flux::multipass_sequence Seq>(Seq seq) {
+    return chunk_adaptor<Seq, N>(std::move(seq));
+};
+
+// Calls fn on each chunk of N elements of seq, sharing the chunks out between
+// n_threads threads, and returns the results in order. Finding where the
+// chunks are is done up front, on the calling thread.
+template <std::size_t N>
+constexpr auto parallel_map_chunks = []<flux::multipass_sequence Seq>(Seq seq, auto fn, int n_threads) {
+    // (The chunks may refer back into the adaptor, so it has to stay alive)
+    auto chunked = chunk<N>(std::move(seq));
+    auto const chunks = chunked.template to<std::vector>();
+    using R = std::invoke_result_t<decltype(fn)&, decltype(chunks.front())>;
+    std::vector<R> results(chunks.size());
+
+    n_threads = std::max(n_threads, 1);
+    std::size_t const per_thread = (chunks.size() + n_threads - 1) / n_threads;
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t begin = 0; begin < chunks.size(); begin += per_thread) {
+            threads.emplace_back([&, begin] {
+                for (std::size_t i = begin; i < std::min(begin + per_thread, chunks.size()); i++) {
+                    results[i] = fn(chunks[i]);
+                }
+            });
+        }
+    }
+    return results;
+};
+
 struct timer {
     using clock = std::chrono::high_resolution_clock;
 
@@ -105,4 +378,22 @@ private:
     typename clock::time_point start_ = clock::now();
 };
 
+/*
+ * For benchmarks: calls fn() and prints its result and how long it took,
+ * plus the throughput if the number of bytes processed is given. Returns
+ * the result, so that it can be checked against other versions.
+ */
+constexpr auto timed = [](std::string_view name, auto fn, std::size_t bytes = 0) {
+    timer t;
+    auto result = fn();
+    auto const elapsed = t.elapsed<std::chrono::duration<double>>();
+    auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+    if (bytes > 0) {
+        fmt::print("{}: {} ({}, {:.2f} GB/s)\n", name, result, ms, bytes / 1e9 / elapsed.count());
+    } else {
+        fmt::print("{}: {} ({})\n", name, result, ms);
+    }
+    return result;
+};
+
 }
@@ -1,27 +1,13 @@
 
 #include "../common.hpp"
 
-template <std::size_t N>
-auto max_n = []<flux::multipass_sequence Seq>(Seq seq)
-{
-    assert(flux::count(seq) >= N);
-
-    std::array<flux::value_t<Seq>, N> max_vals;
-
-    flux::take(std::ref(seq), N).output_to(max_vals.begin());
-    flux::sort(max_vals);
+#include <bit>
+#include <cstring>
+#include <random>
 
-    std::move(seq)
-        .drop(N)
-        .for_each([&max_vals](auto&& elem) {
-            if (elem > max_vals.front()) {
-                max_vals.front() = FLUX_FWD(elem);
-                flux::sort(max_vals);
-            }
-        });
-
-    return flux::from(std::move(max_vals));
-};
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 auto filter_deref = []<flux::sequence Seq>(Seq seq)
 {
@@ -40,12 +26,151 @@ auto solution = [](std::string_view input)
                             ._(filter_deref)
                             .sum();
                 })
-                ._(max_n<N>)
+                ._(aoc::max_n<N>)
                 .sum();
 };
 
-auto part1 = solution<1>;
-auto part2 = solution<3>;
+/*
+ * The same thing, but in a single pass over the input, so it can keep up with
+ * very large inputs.
+ *
+ * The input is scanned 64 bytes at a time, using SIMD compares to make a
+ * bitmask of where the newlines are, so finding the next line is just a
+ * matter of finding the next set bit. Numbers of up to eight digits are then
+ * converted in parallel in a single 64-bit word, by combining neighbouring
+ * bytes, then pairs of bytes, then pairs of those. Lines are assumed to hold
+ * nothing but digits (or nothing at all, between groups).
+ */
+constexpr auto newline_mask = [](std::string_view text, std::size_t i) -> uint64_t {
+    uint64_t mask = 0;
+#ifdef __SSE2__
+    if (!std::is_constant_evaluated() && i + 64 <= text.size()) {
+        auto const newline = _mm_set1_epi8('\n');
+        for (int b = 0; b < 4; b++) {
+            auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(text.data() + i + 16 * b));
+            auto const bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+            mask |= uint64_t{bits} << (16 * b);
+        }
+        return mask;
+    }
+#endif
+    for (std::size_t b = 0; b < 64 && i + b < text.size(); b++) {
+        mask |= uint64_t{text[i + b] == '\n'} << b;
+    }
+    return mask;
+};
+
+constexpr auto load_8 = [](std::string_view text, std::size_t i) -> uint64_t {
+    uint64_t w = 0;
+    if (!std::is_constant_evaluated()) {
+        std::memcpy(&w, text.data() + i, 8);
+        return w;
+    }
+    for (int b = 0; b < 8; b++) {
+        w |= uint64_t{static_cast<unsigned char>(text[i + b])} << (8 * b);
+    }
+    return w;
+};
+
+// Parses the first len (1 to 8) bytes of w as decimal digits, first in the
+// lowest byte
+constexpr auto parse_8 = [](uint64_t w, int len) -> int64_t {
+    w = (w - 0x3030303030303030) << (8 * (8 - len));
+    w = (w * 10 + (w >> 8)) & 0x00FF00FF00FF00FF;
+    w = (w * 100 + (w >> 16)) & 0x0000FFFF0000FFFF;
+    w = (w * 10000 + (w >> 32)) & 0x00000000FFFFFFFF;
+    return static_cast<int64_t>(w);
+};
+
+static_assert(parse_8(load_8("12345678", 0), 8) == 12345678);
+static_assert(parse_8(load_8("907\n1234", 0), 3) == 907);
+
+template <std::size_t N>
+constexpr auto top_group_sums = [](std::string_view text) {
+    aoc::top_k<int64_t, N> top;
+    int64_t group = 0;
+    bool in_group = false;
+    std::size_t line_start = 0;
+
+    auto const end_line = [&](std::size_t line_end) {
+        auto const len = line_end - line_start;
+        if (len == 0) {
+            if (in_group) {
+                top.push(group);
+            }
+            group = 0;
+            in_group = false;
+        } else if (len <= 8 && line_start + 8 <= text.size()) {
+            group += parse_8(load_8(text, line_start), len);
+            in_group = true;
+        } else {
+            int64_t num = 0;
+            for (char c : text.substr(line_start, len)) {
+                num = 10 * num + (c - '0');
+            }
+            group += num;
+            in_group = true;
+        }
+        line_start = line_end + 1;
+    };
+
+    for (std::size_t block = 0; block < text.size(); block += 64) {
+        for (auto mask = newline_mask(text, block); mask != 0; mask &= mask - 1) {
+            end_line(block + std::countr_zero(mask));
+        }
+    }
+    // In case there's no newline at the end
+    if (line_start < text.size()) {
+        end_line(text.size());
+    }
+
+    if (in_group) {
+        top.push(group);
+    }
+    return top;
+};
+
+// For big inputs, the text is cut into one chunk per thread. Each cut is moved
+// forward to the next blank line so that no group is split between chunks.
+template <std::size_t N>
+constexpr auto fast_solution = [](std::string_view input, int n_threads = 1) -> int64_t
+{
+    auto const sum = [](aoc::top_k<int64_t, N> const& top) {
+        return flux::from(top.values()).sum();
+    };
+
+    if (n_threads <= 1 || std::is_constant_evaluated()) {
+        return sum(top_group_sums<N>(input));
+    }
+
+    std::vector<std::string_view> chunks;
+    std::size_t start = 0;
+    for (int t = 1; t < n_threads; t++) {
+        auto const cut = input.find("\n\n", std::max(start, input.size() * t / n_threads));
+        if (cut == std::string_view::npos) {
+            break;
+        }
+        chunks.push_back(input.substr(start, cut + 2 - start));
+        start = cut + 2;
+    }
+    chunks.push_back(input.substr(start));
+
+    std::vector<aoc::top_k<int64_t, N>> tops(chunks.size());
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            threads.emplace_back([&, i] { tops[i] = top_group_sums<N>(chunks[i]); });
+        }
+    }
+
+    for (std::size_t i = 1; i < tops.size(); i++) {
+        tops[0].merge(tops[i]);
+    }
+    return sum(tops[0]);
+};
+
+auto part1 = [](std::string_view input) { return fast_solution<1>(input); };
+auto part2 = [](std::string_view input) { return fast_solution<3>(input); };
 
 constexpr auto test_input =
 R"(1000
@@ -63,10 +188,88 @@ R"(1000
 
 10000)";
 
+// Large enough K to use the heap
+static_assert(flux::ints(0, 100)
+                  .map([](int i) { return (i * 37) % 100; })
+                  ._(aoc::max_n<40>)
+                  .sum() == flux::ints(60, 100).sum());
+
+// Times finding the top K of n random values for various K, on one thread
+// and on all of them, and checks both against sorting
+auto benchmark_top_k = [](int n) {
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> dist;
+    std::vector<int> values(n);
+    for (int& v : values) {
+        v = dist(gen);
+    }
+
+    auto sorted = values;
+    std::ranges::sort(sorted, std::greater<>{});
+
+    int const n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto const run = [&]<std::size_t K>(std::integral_constant<std::size_t, K>) {
+        auto const expected = flux::ref(sorted).take(K).sum();
+
+        aoc::timer t;
+        auto const serial = flux::ref(values)._(aoc::max_n<K>).sum();
+        auto const serial_time = t.elapsed();
+
+        t.reset();
+        auto const parallel = aoc::parallel_max_n<K>(values, n_threads).sum();
+        auto const parallel_time = t.elapsed();
+
+        assert(serial == expected && parallel == expected);
+        fmt::print("K = {}: {} ({} threads: {})\n", K, serial_time, n_threads, parallel_time);
+    };
+
+    run(std::integral_constant<std::size_t, 1>{});
+    run(std::integral_constant<std::size_t, 3>{});
+    run(std::integral_constant<std::size_t, 10>{});
+    run(std::integral_constant<std::size_t, 32>{});
+    run(std::integral_constant<std::size_t, 33>{});
+    run(std::integral_constant<std::size_t, 100>{});
+    run(std::integral_constant<std::size_t, 1000>{});
+};
+
+// Times both solutions on n_groups randomly generated groups
+auto benchmark_solutions = [](int n_groups) {
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> lines(1, 15);
+    std::uniform_int_distribution<int> calories(1000, 60000);
+
+    std::string input;
+    for (int i = 0; i < n_groups; i++) {
+        for (int j = lines(gen); j > 0; j--) {
+            input += std::to_string(calories(gen));
+            input += '\n';
+        }
+        input += '\n';
+    }
+
+    int const n_threads = std::max(1u, std::thread::hardware_concurrency());
+    fmt::print("{:.2f} GB\n", input.size() / 1e9);
+    auto const expected = aoc::timed("flux", [&] { return solution<3>(input); }, input.size());
+    auto const serial = aoc::timed("single pass", [&] { return fast_solution<3>(input); }, input.size());
+    auto const parallel = aoc::timed(fmt::format("{} threads", n_threads),
+                                     [&] { return fast_solution<3>(input, n_threads); }, input.size());
+    assert(serial == expected && parallel == expected);
+};
+
 int main(int argc, char** argv)
 {
+    static_assert(solution<1>(test_input) == 24000);
+    static_assert(solution<3>(test_input) == 45000);
     static_assert(part1(test_input) == 24000);
     static_assert(part2(test_input) == 45000);
+    assert(fast_solution<3>(test_input, 3) == 45000);
+
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark_top_k(10'000'000);
+        benchmark_solutions(5'000'000);
+        return 0;
+    }
 
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
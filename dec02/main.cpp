@@ -1,6 +1,11 @@
 
 #include "../common.hpp"
 
+#include <random>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 /*auto score_p1 = [](int theirs, int mine) {
     return 1 + mine +
@@ -54,8 +59,119 @@ auto calculate = [](std::string_view input) {
             .sum();
 };
 
-auto part1 = calculate<score_table_p1>;
-auto part2 = calculate<score_table_p2>;
+/*
+ * Almost every line is exactly four bytes ("A X\n"), so with AVX2 we can
+ * score eight lines at a time. Treating each line as a 32-bit lane, we
+ * subtract "A X\n" from it bytewise to get the two moves as numbers 0-2,
+ * and combine them into a table index in the lowest byte. A byte shuffle
+ * then looks up the score (the other bytes are set to 0x80, which the
+ * shuffle turns into zero) and sum-of-absolute-differences against zero adds
+ * up the bytes.
+ *
+ * If a block doesn't look like eight well-formed lines we fall back to
+ * scoring a single line at a time, until we're back in step.
+ */
+template <auto& ScoreTable>
+constexpr auto calculate_fast = [](std::string_view input) -> int64_t {
+    int64_t total = 0;
+    std::size_t i = 0;
+
+    auto const score_line = [&] {
+        if (i + 4 <= input.size() && input[i + 1] == ' ' && input[i + 3] == '\n') {
+            total += ScoreTable[3 * (input[i] - 'A') + input[i + 2] - 'X'];
+            i += 4;
+            return;
+        }
+        auto const end = std::min(input.find('\n', i), input.size());
+        auto const line = input.substr(i, end - i);
+        if (line.size() >= 3) {
+            total += ScoreTable[3 * (line[0] - 'A') + line[2] - 'X'];
+        }
+        i = end + 1;
+    };
+
+#ifdef __AVX2__
+    if (!std::is_constant_evaluated()) {
+        auto const table = [] {
+            alignas(32) std::array<char, 32> bytes{};
+            for (std::size_t j = 0; j < ScoreTable.size(); j++) {
+                bytes[j] = bytes[16 + j] = static_cast<char>(ScoreTable[j]);
+            }
+            return _mm256_load_si256(reinterpret_cast<__m256i const*>(bytes.data()));
+        }();
+        auto const base = _mm256_set1_epi32('A' | ' ' << 8 | 'X' << 16 | '\n' << 24);
+        auto const separators = _mm256_set1_epi32(0xFF00FF00);
+        auto const moves = _mm256_set1_epi32(0x00FF00FF);
+        auto const twos = _mm256_set1_epi8(2);
+        auto const high_bits = _mm256_set1_epi32(static_cast<int>(0x80808000));
+        auto sums = _mm256_setzero_si256();
+
+        while (i < input.size()) {
+            if (i + 32 <= input.size()) {
+                auto const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(input.data() + i));
+                auto const diff = _mm256_sub_epi8(bytes, base);
+                auto const move_bytes = _mm256_and_si256(diff, moves);
+                // Separators must match exactly, and moves must be 0 to 2
+                auto const ok = _mm256_and_si256(
+                    _mm256_cmpeq_epi8(_mm256_and_si256(diff, separators), _mm256_setzero_si256()),
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(move_bytes, twos), twos));
+                if (_mm256_movemask_epi8(ok) == -1) {
+                    auto const theirs = _mm256_and_si256(move_bytes, _mm256_set1_epi32(0xFF));
+                    auto const mine = _mm256_srli_epi32(move_bytes, 16);
+                    auto const index = _mm256_add_epi32(_mm256_add_epi32(theirs, _mm256_slli_epi32(theirs, 1)), mine);
+                    auto const scores = _mm256_shuffle_epi8(table, _mm256_or_si256(index, high_bits));
+                    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(scores, _mm256_setzero_si256()));
+                    i += 32;
+                    continue;
+                }
+            }
+            score_line();
+        }
+
+        alignas(32) std::array<int64_t, 4> lanes;
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.data()), sums);
+        return total + flux::ref(lanes).sum();
+    }
+#endif
+
+    while (i < input.size()) {
+        score_line();
+    }
+    return total;
+};
+
+auto part1 = calculate_fast<score_table_p1>;
+auto part2 = calculate_fast<score_table_p2>;
+
+// Times both versions of each part on n random lines, plus a few irregular
+// ones to exercise the fallback
+auto benchmark = [](int n) {
+    std::mt19937 gen(2);
+    std::uniform_int_distribution<int> move(0, 2);
+    std::uniform_int_distribution<int> odd_one_out(0, 1000);
+
+    std::string input;
+    input.reserve(4 * n + n / 100);
+    for (int i = 0; i < n; i++) {
+        input += char('A' + move(gen));
+        input += ' ';
+        input += char('X' + move(gen));
+        if (odd_one_out(gen) == 0) {
+            input += '\r';
+        }
+        input += '\n';
+    }
+
+    auto const time = [&](std::string_view name, auto fn) {
+        return aoc::timed(name, [&] { return fn(input); }, input.size());
+    };
+
+    auto const p1 = time("Part 1 (lines)", calculate<score_table_p1>);
+    auto const p1_fast = time("Part 1 (fast)", part1);
+    auto const p2 = time("Part 2 (lines)", calculate<score_table_p2>);
+    auto const p2_fast = time("Part 2 (fast)", part2);
+    assert(p1 == p1_fast && p2 == p2_fast);
+};
 
 constexpr auto test_data =
 R"(A Y
@@ -68,6 +184,11 @@ int main(int argc, char** argv)
     static_assert(part1(test_data) == 15);
     static_assert(part2(test_data) == 12);
 
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(50'000'000);
+        return 0;
+    }
+
     if (argc < 2) {
         fmt::print(stderr, "No input");
         return -1;
@@ -1,83 +1,40 @@
 
-#include <utility>
-
 #include "../common.hpp"
 
-// This will eventually be upstreamed as chunk<N> (and done properly)
-template <flux::multipass_sequence Seq>
-struct chunk3 : flux::lens_base<chunk3<Seq>> {
-
-    Seq base_;
-
-    constexpr explicit chunk3(Seq&& seq) : base_(std::move(seq)) {}
-
-    struct flux_sequence_iface {
-        static constexpr auto first(auto& self) { return flux::first(self.base_); }
-
-        static constexpr auto is_last(auto& self, auto cursor) -> bool
-        {
-            return flux::is_last(self.base_, cursor) ||
-                   flux::is_last(self.base_, flux::inc(self.base_, cursor)) ||
-                   flux::is_last(self.base_, flux::inc(self.base_, cursor));
-        }
-
-        static constexpr auto read_at(auto& self, auto const& cursor) -> decltype(auto)
-        {
-            auto c2 = flux::next(self.base_, cursor);
-            auto c3 = flux::next(self.base_, c2);
-
-            return std::tuple<flux::element_t<Seq>, flux::element_t<Seq>, flux::element_t<Seq>>(
-                flux::read_at(self.base_, cursor), flux::read_at(self.base_, c2), flux::read_at(self.base_, c3)
-            );
-        }
-
-        static constexpr auto inc(auto& self, auto& cursor) -> auto&
-        {
-            return cursor = flux::next(self.base_, cursor, 3);
-        }
-    };
-
-};
-
-
-auto get_priority = [](char c) -> int
-{
-    if (c >= 'a' && c <= 'z') {
-        return 1 + c - 'a';
-    } else if (c >= 'A' && c <= 'Z') {
-        return 27 + c - 'A';
-    } else {
-        return 0;
-    }
-};
-
+// Conveniently, a letter's priority is its index in an aoc::letter_set, so
+// we just have to find the letter common to each group of compartments or
+// rucksacks
 auto part1 = [](std::string_view input)
 {
     return flux::split_string(input, '\n')
             .filter([](auto str) { return str.size() > 0; })
             .map([](std::string_view input) {
-                auto first = flux::from(input.substr(0, input.size()/2));
-                auto second = flux::from(input.substr(input.size()/2));
-
-                auto cur = second.find_if([&](char c) { return first.contains(c); });
-                return second[cur];
+                aoc::letter_set const first(input.substr(0, input.size()/2));
+                aoc::letter_set const second(input.substr(input.size()/2));
+                return (first & second).first_index();
             })
-            .map(get_priority)
             .sum();
 };
 
+auto badge_priority = [](auto group) {
+    auto& [str1, str2, str3] = group;
+    return (aoc::letter_set(str1) & aoc::letter_set(str2) & aoc::letter_set(str3))
+            .first_index();
+};
+
 auto part2 = [](std::string_view input)
 {
-    return chunk3(flux::split(input, '\n'))
-            .map([](auto tuple) {
-                auto [str1, str2, str3] = tuple;
-                auto r = str1.find_if([&](char c) { return str2.contains(c) && str3.contains(c); });
-                return str1[r];
-            })
-            .map(get_priority)
+    return flux::split(input, '\n')
+            ._(aoc::chunk<3>)
+            .map(badge_priority)
             .sum();
 };
 
+auto part2_parallel = [](std::string_view input, int n_threads)
+{
+    return flux::sum(aoc::parallel_map_chunks<3>(flux::split(input, '\n'), badge_priority, n_threads));
+};
+
 constexpr auto test_data =
 R"(vJrwpWtwJgWrhcsFMMfFFhFp
 jqHRNqRjqzjGDLGLrsFMfFZSrLrFZsSL
@@ -86,11 +43,44 @@ wMqvLMZHhHMvwLHjbvcjnnSBnvTQFn
 ttgJtRGJQctTZtZT
 CrZsJsPPZsGzwwsLwLmpwMDw)";
 
+// Leftover elements which don't fill a chunk are dropped
+static_assert(flux::ints(0, 8)
+                  ._(aoc::chunk<3>)
+                  .map([](auto chunk) { return chunk[0] * chunk[1] * chunk[2]; })
+                  .sum() == 0 * 1 * 2 + 3 * 4 * 5);
+
+// Times part 2 with one thread and with all of them, on the test data
+// repeated n times
+auto benchmark = [](int n) {
+    std::string input;
+    for (int i = 0; i < n; i++) {
+        input += test_data;
+        input += '\n';
+    }
+
+    int const n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    aoc::timer t;
+    auto const serial = part2(input);
+    fmt::print("Part 2: {} ({})\n", serial, t.elapsed<std::chrono::milliseconds>());
+
+    t.reset();
+    auto const parallel = part2_parallel(input, n_threads);
+    fmt::print("Part 2, {} threads: {} ({})\n", n_threads, parallel,
+               t.elapsed<std::chrono::milliseconds>());
+    assert(serial == parallel);
+};
+
 int main(int argc, char** argv)
 {
     static_assert(part1(test_data) == 157);
     static_assert(part2(test_data) == 70);
-    part2(test_data);
+    assert(part2_parallel(test_data, 2) == 70);
+
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(1'000'000);
+        return 0;
+    }
 
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
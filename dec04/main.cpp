@@ -1,6 +1,13 @@
 
 #include "../common.hpp"
 
+#include <bit>
+#include <random>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 struct assignment { int from, to; };
 
 auto parse_line = [](std::string_view line) {
@@ -33,8 +40,137 @@ auto calculate = [](std::string_view input) {
             });
 };
 
-auto part1 = calculate<overlap_p1>;
-auto part2 = calculate<overlap_p2>;
+/*
+ * Both parts at once, for large inputs. The numbers are parsed in a single
+ * pass into four columns (structure-of-arrays), and then both conditions are
+ * checked for each pair. With AVX2 that's eight pairs at a time, using
+ * vector compares and counting the lanes which pass.
+ *
+ * For the second part, two ranges overlap exactly when each one starts no
+ * later than the other ends.
+ */
+struct assignment_columns {
+    std::vector<int32_t> a_from, a_to, b_from, b_to;
+};
+
+// Any run of non-digits separates two numbers
+constexpr auto parse_columns = [](std::string_view input) {
+    assignment_columns cols;
+    auto const lines = static_cast<std::size_t>(std::ranges::count(input, '\n')) + 1;
+    for (auto* col : {&cols.a_from, &cols.a_to, &cols.b_from, &cols.b_to}) {
+        col->reserve(lines);
+    }
+
+    std::array<int32_t, 4> nums{};
+    std::size_t field = 0;
+    int32_t num = 0;
+    bool in_number = false;
+
+    auto const end_number = [&] {
+        nums[field++] = num;
+        num = 0;
+        in_number = false;
+        if (field == nums.size()) {
+            cols.a_from.push_back(nums[0]);
+            cols.a_to.push_back(nums[1]);
+            cols.b_from.push_back(nums[2]);
+            cols.b_to.push_back(nums[3]);
+            field = 0;
+        }
+    };
+
+    for (char c : input) {
+        if (c >= '0' && c <= '9') {
+            num = 10 * num + (c - '0');
+            in_number = true;
+        } else if (in_number) {
+            end_number();
+        }
+    }
+    if (in_number) {
+        end_number();
+    }
+    return cols;
+};
+
+constexpr auto count_both = [](assignment_columns const& cols) -> std::pair<int64_t, int64_t> {
+    int64_t contained = 0;
+    int64_t overlapping = 0;
+    std::size_t i = 0;
+
+#ifdef __AVX2__
+    if (!std::is_constant_evaluated()) {
+        auto const load = [&](std::vector<int32_t> const& col) {
+            return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(col.data() + i));
+        };
+        // Sets the bit for each lane where lhs > rhs
+        auto const greater = [](__m256i lhs, __m256i rhs) {
+            return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lhs, rhs))));
+        };
+
+        for (; i + 8 <= cols.a_from.size(); i += 8) {
+            auto const a_from = load(cols.a_from), a_to = load(cols.a_to);
+            auto const b_from = load(cols.b_from), b_to = load(cols.b_to);
+
+            auto const a_contains_b = ~(greater(a_from, b_from) | greater(b_to, a_to));
+            auto const b_contains_a = ~(greater(b_from, a_from) | greater(a_to, b_to));
+            auto const overlap = ~(greater(a_from, b_to) | greater(b_from, a_to));
+
+            contained += std::popcount((a_contains_b | b_contains_a) & 0xFFu);
+            overlapping += std::popcount(overlap & 0xFFu);
+        }
+    }
+#endif
+
+    for (; i < cols.a_from.size(); i++) {
+        assignment const a{cols.a_from[i], cols.a_to[i]};
+        assignment const b{cols.b_from[i], cols.b_to[i]};
+        contained += overlap_p1(a, b) || overlap_p1(b, a);
+        overlapping += a.from <= b.to && b.from <= a.to;
+    }
+
+    return {contained, overlapping};
+};
+
+constexpr auto solve = [](std::string_view input) {
+    return count_both(parse_columns(input));
+};
+
+auto part1 = [](std::string_view input) { return solve(input).first; };
+auto part2 = [](std::string_view input) { return solve(input).second; };
+
+// Times the line-by-line version of each part against solving both at once,
+// on n random pairs of ranges
+auto benchmark = [](int n) {
+    std::mt19937 gen(4);
+    std::uniform_int_distribution<int> section(1, 99);
+    auto const range = [&] {
+        auto const [from, to] = std::minmax({section(gen), section(gen)});
+        return fmt::format("{}-{}", from, to);
+    };
+
+    std::string input;
+    for (int i = 0; i < n; i++) {
+        input += range();
+        input += ',';
+        input += range();
+        input += '\n';
+    }
+
+    aoc::timer t;
+    auto const p1 = calculate<overlap_p1>(input);
+    auto const p2 = calculate<overlap_p2>(input);
+    fmt::print("Line by line: {}, {} ({})\n", p1, p2, t.elapsed<std::chrono::milliseconds>());
+
+    t.reset();
+    auto const cols = parse_columns(input);
+    auto const parse_time = t.elapsed<std::chrono::milliseconds>();
+    t.reset();
+    auto const [p1_cols, p2_cols] = count_both(cols);
+    fmt::print("Columns: {}, {} (parse {}, count {})\n", p1_cols, p2_cols, parse_time,
+               t.elapsed<std::chrono::microseconds>());
+    assert(p1 == p1_cols && p2 == p2_cols);
+};
 
 constexpr auto test_data =
 R"(2-4,6-8
@@ -49,6 +185,13 @@ int main(int argc, char** argv)
 {
     static_assert(part1(test_data) == 2);
     static_assert(part2(test_data) == 4);
+    static_assert(calculate<overlap_p1>(test_data) == 2);
+    static_assert(calculate<overlap_p2>(test_data) == 4);
+
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(10'000'000);
+        return 0;
+    }
 
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
@@ -57,6 +200,7 @@ int main(int argc, char** argv)
 
     auto const input = aoc::string_from_file(argv[1]);
 
-    fmt::print("Part 1: {}\n", part1(input));
-    fmt::print("Part 2: {}\n", part2(input));
+    auto const [p1, p2] = solve(input);
+    fmt::print("Part 1: {}\n", p1);
+    fmt::print("Part 2: {}\n", p2);
 }
\ No newline at end of file
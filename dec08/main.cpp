@@ -1,38 +1,351 @@
 
 #include "../common.hpp"
 
-auto part1 = [](std::string_view trees) {
-    auto const y_max = flux::count(trees, '\n');
-    auto const x_max = flux::distance_t(trees.find('\n'));
-
-    auto height = [&](auto a, auto b) { return trees.at((x_max + 1) * b + a); };
-
-    return flux::cartesian_product_with([&](auto x, auto y) {
-                auto const h = height(x, y);
-                return flux::ints(0    , x    ).all([&](auto i) { return height(i, y) < h; })
-                    || flux::ints(x + 1, x_max).all([&](auto i) { return height(i, y) < h; })
-                    || flux::ints(0    , y    ).all([&](auto j) { return height(x, j) < h; })
-                    || flux::ints(y + 1, y_max).all([&](auto j) { return height(x, j) < h; });
-            }, flux::ints(0, x_max), flux::ints(0, y_max))
-            .count(true);
+#include <random>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * The input is used as-is as the grid: each row is followed by a newline,
+ * so moving down a row means skipping forward width + 1 characters.
+ *
+ * Both parts look along every row and column in both directions. A line is
+ * described by the index of its first tree, the stride to the next one, and
+ * its length.
+ */
+struct line {
+    std::ptrdiff_t start;
+    std::ptrdiff_t stride;
+    std::ptrdiff_t length;
+};
+
+struct forest {
+    std::string_view trees;
+    std::ptrdiff_t width;
+    std::ptrdiff_t height;
+
+    constexpr explicit forest(std::string_view input)
+        : trees(input),
+          width(input.find('\n')),
+          height(flux::count(input, '\n'))
+    {}
+
+    constexpr auto size() const { return trees.size(); }
+
+    // Calls fn(line) for every row and column, in each direction
+    constexpr void for_each_line(auto fn) const
+    {
+        auto const row_stride = width + 1;
+        for (std::ptrdiff_t y = 0; y < height; y++) {
+            fn(line{y * row_stride, 1, width});
+            fn(line{y * row_stride + width - 1, -1, width});
+        }
+        for (std::ptrdiff_t x = 0; x < width; x++) {
+            fn(line{x, row_stride, height});
+            fn(line{(height - 1) * row_stride + x, -row_stride, height});
+        }
+    }
 };
 
-auto part2 = [](std::string_view trees) {
-    auto const y_max = flux::count(trees, '\n');
-    auto const x_max = flux::distance_t(trees.find('\n'));
+// A tree is visible from some direction if it is taller than every tree
+// before it in that direction, so we just keep a running maximum
+auto part1_lines = [](std::string_view input) {
+    forest const f(input);
+    std::vector<bool> visible(f.size(), false);
 
-    auto height = [&](auto a, auto b) { return trees.at((x_max + 1) * a + b); };
+    f.for_each_line([&](line l) {
+        char tallest = 0;
+        for (std::ptrdiff_t i = l.start, n = 0; n < l.length; i += l.stride, n++) {
+            if (f.trees[i] > tallest) {
+                visible[i] = true;
+                tallest = f.trees[i];
+            }
+        }
+    });
 
-    return flux::cartesian_product_with([&](auto const x, auto const y) {
-                auto const h = height(x, y);
-                return (1 + flux::ints(1, x).reverse().take_while([&](auto i) { return height(i, y) < h; }).count())
-                     * (1 + flux::ints(x + 1, x_max - 1).take_while([&](auto i) { return height(i, y) < h; }).count())
-                     * (1 + flux::ints(1, y).reverse().take_while([&](auto j) { return height(x, j) < h; }).count())
-                     * (1 + flux::ints(y + 1, y_max - 1).take_while([&](auto j) {  return height(x, j) < h; }).count());
-            }, flux::ints(1, x_max - 1), flux::ints(1, y_max - 1))
+    return flux::count(visible, true);
+};
+
+// Looking back along a line, a tree can see as far as the nearest tree which
+// is at least as tall. Keeping a stack of trees in decreasing order of height
+// (popping any which are shorter than the current tree, which can never block
+// the view of anything later) means the top of the stack is always the tree
+// that blocks the view.
+auto part2_lines = [](std::string_view input) {
+    forest const f(input);
+    std::vector<std::int64_t> score(f.size(), 1);
+    std::vector<std::ptrdiff_t> stack;
+
+    f.for_each_line([&](line l) {
+        stack.clear();
+        for (std::ptrdiff_t i = l.start, n = 0; n < l.length; i += l.stride, n++) {
+            while (!stack.empty() && f.trees[l.start + stack.back() * l.stride] < f.trees[i]) {
+                stack.pop_back();
+            }
+            score[i] *= stack.empty() ? n : n - stack.back();
+            stack.push_back(n);
+        }
+    });
+
+    // Don't count the newlines
+    return flux::ints(0, f.size())
+            .filter([&](auto i) { return f.trees[i] != '\n'; })
+            .map([&](auto i) { return score[i]; })
             .max().value();
 };
 
+/*
+ * The versions above walk every column with a stride of a whole row, which
+ * is slow on big grids because each step touches a new cache line. The
+ * versions below only ever walk the grid a row at a time.
+ *
+ * For part 1, sweeping down (or up) the grid a row at a time keeps one
+ * running maximum per column, and those are independent, so we can update 32
+ * columns at once with byte-wise max and compare. To handle the left and
+ * right directions the same way we transpose the grid first, so that its rows
+ * become columns.
+ */
+
+// Marks trees in row which are taller than the tallest tree seen so far in
+// their column, and updates the running maximums
+constexpr void sweep_row(char const* row, char* tallest, char* visible,
+                         std::ptrdiff_t width)
+{
+    std::ptrdiff_t x = 0;
+#ifdef __AVX2__
+    if (!std::is_constant_evaluated()) {
+        for (; x + 32 <= width; x += 32) {
+            auto const load = [](char const* p) {
+                return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+            };
+            auto const trees = load(row + x);
+            auto const max = load(tallest + x);
+            auto const taller = _mm256_cmpgt_epi8(trees, max);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + x),
+                                _mm256_or_si256(load(visible + x), taller));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(tallest + x),
+                                _mm256_max_epi8(trees, max));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        if (row[x] > tallest[x]) {
+            visible[x] = 1;
+            tallest[x] = row[x];
+        }
+    }
+}
+
+// Marks the trees in a width * height grid (with rows stride apart) which are
+// visible from the top or bottom. Visible is a packed width * height array.
+constexpr void column_visibility(char const* trees, std::ptrdiff_t width,
+                                 std::ptrdiff_t height, std::ptrdiff_t stride,
+                                 char* visible)
+{
+    std::vector<char> tallest(width, 0);
+    for (std::ptrdiff_t y = 0; y < height; y++) {
+        sweep_row(trees + y * stride, tallest.data(), visible + y * width, width);
+    }
+
+    std::ranges::fill(tallest, 0);
+    for (std::ptrdiff_t y = height - 1; y >= 0; y--) {
+        sweep_row(trees + y * stride, tallest.data(), visible + y * width, width);
+    }
+}
+
+// Calls fn(x, y) for every cell of a width * height grid, in small square
+// tiles. When reading a grid along rows and another along columns, this
+// keeps the lines being used from both of them in cache.
+constexpr void for_each_tiled(std::ptrdiff_t width, std::ptrdiff_t height, auto fn)
+{
+    constexpr std::ptrdiff_t tile = 32;
+    for (std::ptrdiff_t y0 = 0; y0 < height; y0 += tile) {
+        for (std::ptrdiff_t x0 = 0; x0 < width; x0 += tile) {
+            for (auto y = y0; y < std::min(y0 + tile, height); y++) {
+                for (auto x = x0; x < std::min(x0 + tile, width); x++) {
+                    fn(x, y);
+                }
+            }
+        }
+    }
+}
+
+// Returns the width * height grid (with rows stride apart) transposed into a
+// packed height * width grid
+constexpr auto transpose(char const* grid, std::ptrdiff_t width,
+                         std::ptrdiff_t height, std::ptrdiff_t stride)
+{
+    std::vector<char> out(width * height);
+    for_each_tiled(width, height, [&](auto x, auto y) {
+        out[x * height + y] = grid[y * stride + x];
+    });
+    return out;
+}
+
+auto part1 = [](std::string_view input) {
+    forest const f(input);
+    auto const [w, h] = std::pair(f.width, f.height);
+
+    std::vector<char> from_ends(w * h, 0);
+    column_visibility(f.trees.data(), w, h, w + 1, from_ends.data());
+
+    auto const transposed = transpose(f.trees.data(), w, h, w + 1);
+    std::vector<char> transposed_from_sides(h * w, 0);
+    column_visibility(transposed.data(), h, w, h, transposed_from_sides.data());
+    auto const from_sides = transpose(transposed_from_sides.data(), h, w, h);
+
+    return flux::ints(0, w * h)
+            .count_if([&](auto i) { return from_ends[i] || from_sides[i]; });
+};
+
+/*
+ * For part 2, since there are only ten possible heights, rather than a stack
+ * we can remember where we last saw a tree of each height or taller. A tree
+ * of height t can then see back as far as blocker[t], and becomes the new
+ * blocker for every height up to t.
+ *
+ * As in part 1 we sweep down and then up the grid a row at a time, keeping
+ * ten blockers for each column. They're stored as ten rows (one per height)
+ * of one entry per column, so that a whole row of trees is handled with
+ * straight loops along those rows, several columns at a time.
+ *
+ * The first sweep, down the grid, stores each tree's view upwards. The
+ * second goes back up a strip of rows at a time, finding the view downwards.
+ * Transposing the strip turns its rows into columns, so the same sweeps
+ * find the views left and right, and then all four are to hand while the
+ * strip is still in cache.
+ *
+ * A blocker is the 16-bit number of steps into the sweep at which the tree
+ * was seen, so the view distance is just the current step minus the blocker,
+ * whichever way we're going. The views up and down (or left and right) add
+ * up to less than 65535, so their product fits in 32 bits. Bigger grids use
+ * part2_lines instead.
+ */
+constexpr std::ptrdiff_t max_sweep_length = 65535;
+
+// Finds the view distances for a row of trees, at the given step of a sweep
+constexpr void sweep_views(char const* row, std::uint16_t step, std::uint16_t* blockers,
+                           std::uint16_t* dist, std::ptrdiff_t width)
+{
+    std::ptrdiff_t x = 0;
+#ifdef __AVX2__
+    if (!std::is_constant_evaluated()) {
+        auto const at = [](auto* p) { return reinterpret_cast<__m256i*>(p); };
+        auto const pos = _mm256_set1_epi16(static_cast<short>(step));
+        for (; x + 16 <= width; x += 16) {
+            auto const trees = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + x)));
+
+            auto blocker = _mm256_setzero_si256();
+            for (int k = 0; k < 10; k++) {
+                auto* const b = at(blockers + k * width + x);
+                auto const height = _mm256_set1_epi16(static_cast<short>('0' + k));
+                auto const old = _mm256_loadu_si256(b);
+                blocker = _mm256_blendv_epi8(blocker, old, _mm256_cmpeq_epi16(trees, height));
+                _mm256_storeu_si256(b, _mm256_blendv_epi8(pos, old, _mm256_cmpgt_epi16(height, trees)));
+            }
+            _mm256_storeu_si256(at(dist + x), _mm256_sub_epi16(pos, blocker));
+        }
+    }
+#endif
+#ifdef __SSE2__
+    if (!std::is_constant_evaluated()) {
+        auto const at = [](auto* p) { return reinterpret_cast<__m128i*>(p); };
+        auto const pos = _mm_set1_epi16(static_cast<short>(step));
+        for (; x + 8 <= width; x += 8) {
+            auto const trees = _mm_unpacklo_epi8(
+                _mm_loadl_epi64(reinterpret_cast<__m128i const*>(row + x)), _mm_setzero_si128());
+
+            auto blocker = _mm_setzero_si128();
+            for (int k = 0; k < 10; k++) {
+                auto* const b = at(blockers + k * width + x);
+                auto const height = _mm_set1_epi16(static_cast<short>('0' + k));
+                auto const old = _mm_loadu_si128(b);
+                auto const shorter = _mm_cmpgt_epi16(height, trees);
+                blocker = _mm_or_si128(blocker, _mm_and_si128(_mm_cmpeq_epi16(trees, height), old));
+                _mm_storeu_si128(b, _mm_or_si128(_mm_and_si128(shorter, old), _mm_andnot_si128(shorter, pos)));
+            }
+            _mm_storeu_si128(at(dist + x), _mm_sub_epi16(pos, blocker));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        int const t = row[x] - '0';
+        dist[x] = static_cast<std::uint16_t>(step - blockers[t * width + x]);
+        for (int k = 0; k <= t; k++) {
+            blockers[k * width + x] = step;
+        }
+    }
+}
+
+auto part2 = [](std::string_view input) -> std::int64_t {
+    forest const f(input);
+    auto const [w, h] = std::pair(f.width, f.height);
+    if (w > max_sweep_length || h > max_sweep_length) {
+        return part2_lines(input);
+    }
+    auto const row = [&](std::ptrdiff_t y) { return f.trees.data() + y * (w + 1); };
+
+    std::vector<std::uint16_t> blockers(10 * w, 0);
+    std::vector<std::uint16_t> up(w * h);
+    for (std::ptrdiff_t y = 0; y < h; y++) {
+        sweep_views(row(y), static_cast<std::uint16_t>(y), blockers.data(), up.data() + y * w, w);
+    }
+
+    constexpr std::ptrdiff_t strip = 64;
+    std::ranges::fill(blockers, 0);
+    std::vector<std::uint16_t> dist(std::max(w, strip));
+    std::vector<std::uint16_t> left(w * strip);
+    std::vector<std::uint16_t> across_blockers(10 * strip);
+    // Views up times down for the rows of the strip, and left times right
+    // for its columns (in transposed order)
+    std::vector<std::uint32_t> vertical(strip * w);
+    std::vector<std::uint32_t> horizontal(w * strip);
+    std::int64_t best = 0;
+
+    for (std::ptrdiff_t y_end = h; y_end > 0; y_end -= strip) {
+        auto const y0 = std::max(y_end - strip, std::ptrdiff_t{0});
+        auto const n = y_end - y0;
+
+        for (auto y = y_end - 1; y >= y0; y--) {
+            sweep_views(row(y), static_cast<std::uint16_t>(h - 1 - y), blockers.data(), dist.data(), w);
+            auto const i = y - y0;
+            for (std::ptrdiff_t x = 0; x < w; x++) {
+                vertical[i * w + x] = std::uint32_t{up[y * w + x]} * dist[x];
+            }
+        }
+
+        // Row x of the transposed strip is column x of the original
+        auto const across = transpose(row(y0), w, n, w + 1);
+        auto const column = [&](std::ptrdiff_t x) { return across.data() + x * n; };
+
+        std::fill_n(across_blockers.begin(), 10 * n, 0);
+        for (std::ptrdiff_t x = 0; x < w; x++) {
+            sweep_views(column(x), static_cast<std::uint16_t>(x), across_blockers.data(),
+                        left.data() + x * n, n);
+        }
+
+        std::fill_n(across_blockers.begin(), 10 * n, 0);
+        for (auto x = w - 1; x >= 0; x--) {
+            sweep_views(column(x), static_cast<std::uint16_t>(w - 1 - x), across_blockers.data(),
+                        dist.data(), n);
+            for (std::ptrdiff_t i = 0; i < n; i++) {
+                horizontal[x * n + i] = std::uint32_t{left[x * n + i]} * dist[i];
+            }
+        }
+
+        for_each_tiled(w, n, [&](auto x, auto i) {
+            best = std::max(best, std::int64_t{vertical[i * w + x]} * horizontal[x * n + i]);
+        });
+    }
+
+    return best;
+};
+
 constexpr auto test_data =
 R"(30373
 25512
@@ -41,11 +354,44 @@ R"(30373
 35390
 )";
 
+static_assert(part1_lines(test_data) == 21);
+static_assert(part2_lines(test_data) == 8);
 static_assert(part1(test_data) == 21);
 static_assert(part2(test_data) == 8);
 
+// Times both versions of each part on a randomly generated n*n forest
+auto benchmark = [](int n) {
+    std::mt19937 gen(8);
+    std::uniform_int_distribution<int> dist(0, 9);
+
+    std::string input;
+    input.reserve(n * (n + 1));
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            input += static_cast<char>('0' + dist(gen));
+        }
+        input += '\n';
+    }
+
+    auto const time = [&](std::string_view name, auto fn) {
+        return aoc::timed(name, [&] { return fn(input); });
+    };
+
+    auto const p1_lines = time("Part 1 (lines)", part1_lines);
+    auto const p1_rows = time("Part 1 (rows)", part1);
+    auto const p2_lines = time("Part 2 (lines)", part2_lines);
+    auto const p2_rows = time("Part 2 (rows)", part2);
+    assert(p1_lines == p1_rows);
+    assert(p2_lines == p2_rows);
+};
+
 int main(int argc, char** argv)
 {
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(5000);
+        return 0;
+    }
+
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
         return -1;
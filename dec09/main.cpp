@@ -27,10 +27,180 @@ auto update_knot = [](position const& prev, position& knot) {
     }
 };
 
+/*
+ * The cells the tail has visited, stored as the horizontal and vertical runs
+ * of cells it moved along (a lone cell is a horizontal run of length one).
+ * Each step which carries on in a straight line just extends the latest run,
+ * and whenever the list of runs doubles in length we merge the overlapping
+ * ones. That keeps memory proportional to the cells visited, however many
+ * times the tail turns and however far the rope travels.
+ *
+ * To count the distinct cells we merge overlapping runs in each row and each
+ * column, then subtract the cells where a horizontal and a vertical run
+ * cross. Those are counted by sweeping up the grid, keeping track of which
+ * columns currently have a vertical run in a Fenwick tree.
+ */
+struct run {
+    int line; // y for a horizontal run, x for a vertical one
+    int lo, hi; // inclusive
+};
+
+class trail {
+    std::vector<run> rows_;
+    std::vector<run> cols_;
+    position last_{};
+    bool last_is_row_ = true;
+    std::size_t compact_at_ = min_compact;
+
+    static constexpr std::size_t min_compact = 1024;
+
+    static constexpr auto merged(std::vector<run> runs)
+    {
+        std::ranges::sort(runs, {}, [](run const& r) { return std::pair(r.line, r.lo); });
+        std::vector<run> out;
+        for (run const& r : runs) {
+            if (!out.empty() && out.back().line == r.line && r.lo <= out.back().hi + 1) {
+                out.back().hi = std::max(out.back().hi, r.hi);
+            } else {
+                out.push_back(r);
+            }
+        }
+        return out;
+    }
+
+    static constexpr auto count_crossings(std::vector<run> const& rows,
+                                          std::vector<run> const& cols)
+        -> std::int64_t
+    {
+        // Columns which have a vertical run, in order, for the Fenwick tree
+        std::vector<int> xs;
+        for (run const& c : cols) {
+            xs.push_back(c.line);
+        }
+        std::ranges::sort(xs);
+        auto const [first, last] = std::ranges::unique(xs);
+        xs.erase(first, last);
+
+        std::vector<int> tree(xs.size() + 1);
+        auto const add = [&](int x, int n) {
+            for (auto i = std::ranges::lower_bound(xs, x) - xs.begin() + 1; i < std::ssize(tree); i += i & -i) {
+                tree[i] += n;
+            }
+        };
+        // Number of active columns <= x
+        auto const prefix = [&](int x) {
+            std::int64_t sum = 0;
+            for (auto i = std::ranges::upper_bound(xs, x) - xs.begin(); i > 0; i -= i & -i) {
+                sum += tree[i];
+            }
+            return sum;
+        };
+
+        // Columns start before and end after any rows at the same y
+        enum kind { start, row, end };
+        struct event {
+            int y;
+            kind k;
+            run const* r;
+        };
+        std::vector<event> events;
+        for (run const& c : cols) {
+            events.push_back({c.lo, start, &c});
+            events.push_back({c.hi, end, &c});
+        }
+        for (run const& r : rows) {
+            events.push_back({r.line, row, &r});
+        }
+        std::ranges::sort(events, {}, [](event const& e) { return std::pair(e.y, e.k); });
+
+        std::int64_t crossings = 0;
+        for (event const& e : events) {
+            switch (e.k) {
+            case start: add(e.r->line, 1); break;
+            case end: add(e.r->line, -1); break;
+            case row: crossings += prefix(e.r->hi) - prefix(e.r->lo - 1); break;
+            }
+        }
+        return crossings;
+    }
+
+    constexpr void compact_if_needed()
+    {
+        if (rows_.size() + cols_.size() < compact_at_) {
+            return;
+        }
+        rows_ = merged(std::move(rows_));
+        cols_ = merged(std::move(cols_));
+        // insert() extends the last run, so start a new one at the last cell
+        rows_.push_back({last_.y, last_.x, last_.x});
+        last_is_row_ = true;
+        compact_at_ = std::max(min_compact, 2 * (rows_.size() + cols_.size()));
+    }
+
+public:
+    constexpr explicit trail(position const& start)
+        : rows_{{start.y, start.x, start.x}},
+          last_(start)
+    {}
+
+    // Adds p, which must be the same as or next to the last cell added
+    constexpr void insert(position const& p)
+    {
+        if (p == last_) {
+            return;
+        }
+
+        if (p.y == last_.y && abs(p.x - last_.x) == 1 && last_is_row_) {
+            rows_.back().lo = std::min(rows_.back().lo, p.x);
+            rows_.back().hi = std::max(rows_.back().hi, p.x);
+        } else if (p.x == last_.x && abs(p.y - last_.y) == 1 &&
+                   (!last_is_row_ || rows_.back().lo == rows_.back().hi)) {
+            if (last_is_row_) {
+                rows_.pop_back();
+                cols_.push_back({p.x, last_.y, last_.y});
+                last_is_row_ = false;
+            }
+            cols_.back().lo = std::min(cols_.back().lo, p.y);
+            cols_.back().hi = std::max(cols_.back().hi, p.y);
+        } else {
+            rows_.push_back({p.y, p.x, p.x});
+            last_is_row_ = true;
+        }
+        last_ = p;
+        compact_if_needed();
+    }
+
+    // Adds every cell on the horizontal or vertical line from the last cell
+    // added to p
+    constexpr void insert_line(position const& p)
+    {
+        if (p.y == last_.y) {
+            rows_.push_back({p.y, std::min(p.x, last_.x), std::max(p.x, last_.x)});
+            last_is_row_ = true;
+        } else {
+            cols_.push_back({p.x, std::min(p.y, last_.y), std::max(p.y, last_.y)});
+            last_is_row_ = false;
+        }
+        last_ = p;
+        compact_if_needed();
+    }
+
+    constexpr auto n_runs() const { return rows_.size() + cols_.size(); }
+
+    constexpr auto size() const -> std::int64_t
+    {
+        auto const rows = merged(rows_);
+        auto const cols = merged(cols_);
+        auto const length = [](run const& r) -> std::int64_t { return r.hi - r.lo + 1; };
+        return flux::ref(rows).map(length).sum() + flux::ref(cols).map(length).sum()
+               - count_crossings(rows, cols);
+    }
+};
+
 template <int RopeSize>
 auto calculate = [](std::string_view input) {
     std::array<position, RopeSize> rope{};
-    std::vector<position> positions{{0, 0}};
+    trail visited(rope.back());
 
     flux::split_string(input, '\n')
         .filter([](auto sv) { return !sv.empty(); })
@@ -38,25 +208,47 @@ auto calculate = [](std::string_view input) {
             char const dir = line.at(0);
             int const steps = aoc::try_parse<int>(line.substr(2)).value();
 
-            flux::ints(0, steps).for_each([&](auto) {
-                auto& head = rope.front();
+            position const delta = [&] {
                 switch (dir) {
-                case 'U': ++head.y; break;
-                case 'D': --head.y; break;
-                case 'R': ++head.x; break;
-                case 'L': --head.x; break;
+                case 'U': return position{0, 1};
+                case 'D': return position{0, -1};
+                case 'R': return position{1, 0};
+                default: return position{-1, 0};
                 }
+            }();
+
+            // Once every knot is directly behind the one in front of it, each
+            // step just moves the whole rope along by one, so we can do all
+            // the rest of the steps at once
+            auto const is_straight = [&] {
+                return flux::ints(1, RopeSize).all([&](auto i) {
+                    return rope[i].x == rope[i - 1].x - delta.x &&
+                           rope[i].y == rope[i - 1].y - delta.y;
+                });
+            };
+
+            int remaining = steps;
+            while (remaining > 0 && !is_straight()) {
+                auto& head = rope.front();
+                head.x += delta.x;
+                head.y += delta.y;
                 for (std::size_t i = 1; i < RopeSize; i++) {
                     update_knot(rope[i - 1], rope[i]);
                 }
-                positions.push_back(rope.back());
-            });
+                visited.insert(rope.back());
+                --remaining;
+            }
+
+            if (remaining > 0) {
+                for (auto& knot : rope) {
+                    knot.x += remaining * delta.x;
+                    knot.y += remaining * delta.y;
+                }
+                visited.insert_line(rope.back());
+            }
         });
 
-    flux::sort(positions);
-    // no unique algo in Flux yet :(
-    auto [from, to] = std::ranges::unique(positions);
-    return std::distance(positions.begin(), from);
+    return visited.size();
 };
 
 auto part1 = calculate<2>;
@@ -87,6 +279,26 @@ static_assert(part1(test_data1) == 13);
 static_assert(part2(test_data1) == 1);
 static_assert(part2(test_data2) == 36);
 
+// A long walk around a small area mustn't keep adding runs. Each lap of this
+// ring adds four, so without merging there would be 1200 of them.
+constexpr auto test_small_area = [] {
+    constexpr std::array<position, 8> ring{{
+        {1, 0}, {2, 0}, {2, 1}, {2, 2}, {1, 2}, {0, 2}, {0, 1}, {0, 0}
+    }};
+
+    trail t({0, 0});
+    for (int i = 0; i < 2400; i++) {
+        t.insert(ring[i % ring.size()]);
+    }
+    bool const small = t.size() == 8 && t.n_runs() < 1024;
+
+    // Straight lines still work after merging
+    t.insert_line({0, -5});
+    t.insert({1, -5});
+    return small && t.size() == 14;
+};
+static_assert(test_small_area());
+
 }
 
 int main(int argc, char** argv)
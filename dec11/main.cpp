@@ -3,28 +3,40 @@
 
 #include "../extern/ctre.hpp"
 
-template <flux::distance_t N>
-auto max_n = []<flux::multipass_sequence Seq>(Seq seq)
-{
-    assert(flux::count(seq) >= N);
-
-    std::array<flux::value_t<Seq>, N> max_vals;
-
-    flux::take(std::ref(seq), N).output_to(max_vals.begin());
-    flux::sort(max_vals);
-
-    std::move(seq)
-        .drop(N)
-        .for_each([&max_vals](auto&& elem) {
-            if (elem > max_vals.front()) {
-                max_vals.front() = FLUX_FWD(elem);
-                flux::sort(max_vals);
-            }
-        });
-
-    return flux::from(std::move(max_vals));
+#include <atomic>
+#include <numeric>
+#include <random>
+#include <thread>
+
+/*
+ * Computes n % d using multiplications instead of a (slow) division, by
+ * Barrett reduction. With m = floor((2^64 - 1) / d), the quotient estimate
+ * (n * m) / 2^64 is never too big and at most one too small, so at most one
+ * correction is needed.
+ */
+struct fast_mod {
+    uint64_t d = 1;
+    uint64_t m = ~uint64_t{0};
+
+    constexpr fast_mod() = default;
+
+    constexpr explicit fast_mod(uint64_t d)
+        : d(d), m(~uint64_t{0} / d)
+    {}
+
+    constexpr auto operator()(uint64_t n) const -> uint64_t
+    {
+        auto const q = static_cast<uint64_t>((static_cast<unsigned __int128>(n) * m) >> 64);
+        auto const r = n - q * d;
+        return r >= d ? r - d : r;
+    }
 };
 
+static_assert(flux::ints(0, 1000).all([](uint64_t n) {
+    return flux::ints(1, 50).all([n](uint64_t d) { return fast_mod(d)(n) == n % d; });
+}));
+static_assert(fast_mod(9699690)(~uint64_t{0}) == ~uint64_t{0} % 9699690);
+
 enum class operation {
     add, multiply
 };
@@ -34,9 +46,9 @@ struct monkey {
     operation op;
     int arg;
     int divisor;
+    fast_mod divisor_mod;
     int true_dest;
     int false_dest;
-    int64_t count = 0;
 };
 
 constexpr auto& monkey_regex =
@@ -62,6 +74,7 @@ auto parse_input = [](std::string_view input) -> std::vector<monkey> {
                     .op = op == "+" ? operation::add : operation::multiply,
                     .arg = arg == "old" ? -1 : arg.to_number(),
                     .divisor = div.to_number(),
+                    .divisor_mod = fast_mod(div.to_number()),
                     .true_dest = true_.to_number(),
                     .false_dest = false_.to_number()
                 };
@@ -76,60 +89,297 @@ auto print_monkey = [](monkey const& m) {
     fmt::print("  True: {}, false: {}\n", m.true_dest, m.false_dest);
 };
 
-template <bool Part1>
-auto do_round = [](std::vector<monkey>& monkeys, int64_t lcm = 0) {
+auto inspect = [](monkey const& m, int64_t i) -> int64_t {
+    int64_t const arg = (m.arg >= 0) ? m.arg : i;
+    return m.op == operation::add ? i + arg : i * arg;
+};
+
+// Worry levels are kept below the lcm, so it must be at most
+// floor(sqrt(INT64_MAX)) for squaring one not to overflow
+constexpr int64_t max_lcm = 3'037'000'499;
+static_assert(__int128{max_lcm} * max_lcm <= std::numeric_limits<int64_t>::max());
+static_assert(__int128{max_lcm + 1} * (max_lcm + 1) > std::numeric_limits<int64_t>::max());
+
+// Worry levels can be kept modulo this without changing the result of any
+// monkey's test. (It's accumulated as int64_t, since a product of the
+// divisors soon overflows an int.)
+auto lcm_of_divisors = [](std::vector<monkey> const& monkeys) {
+    int64_t const lcm = flux::ref(monkeys)
+            .map(&monkey::divisor)
+            .fold([](int64_t acc, int d) { return std::lcm(acc, int64_t{d}); }, int64_t{1});
+    assert(lcm <= max_lcm);
+    return lcm;
+};
 
-    for (auto& monkey : monkeys) {
-        for (int64_t i : monkey.items) {
-            ++monkey.count;
+// With enough rounds this won't fit in 64 bits
+auto monkey_business = [](std::vector<int64_t> counts) -> __int128 {
+    return flux::from(std::move(counts))
+                ._(aoc::max_n<2>)
+                .map([](int64_t c) -> __int128 { return c; })
+                .product();
+};
 
-            // Monkey inspects item
-            switch (monkey.op) {
-            case operation::add: i += (monkey.arg >= 0) ? monkey.arg : i; break;
-            case operation::multiply: i *= (monkey.arg >= 0) ? monkey.arg : i; break;
+/*
+ * To simulate round by round, all the items live in one flat array rather
+ * than a vector per monkey. Any monkey could end up holding every item, so
+ * each one gets a fixed slot with room for all of them, plus a count of how
+ * many it currently has.
+ *
+ * This deliberately isn't a ring buffer of just the total number of items:
+ * items thrown to a later monkey must join its queue in the same round,
+ * so the queues can't be laid out ahead of time. The fixed slots take
+ * monkeys * items memory, which for real inputs is a few kilobytes, and in
+ * return pushing is a single store with no wrap-around or compaction.
+ */
+struct item_queues {
+    std::size_t capacity;
+    std::vector<int64_t> worries;
+    std::vector<std::size_t> sizes;
+
+    explicit item_queues(std::vector<monkey> const& monkeys)
+        : capacity(flux::ref(monkeys).map([](monkey const& m) { return m.items.size(); }).sum()),
+          worries(capacity * monkeys.size()),
+          sizes(monkeys.size())
+    {
+        for (std::size_t m = 0; m < monkeys.size(); m++) {
+            for (int64_t worry : monkeys[m].items) {
+                push(m, worry);
             }
+        }
+    }
+
+    auto items(std::size_t m) -> std::span<int64_t>
+    {
+        return {worries.data() + m * capacity, sizes[m]};
+    }
+
+    // Empties monkey m's slot, returning the items it held. They stay valid
+    // until something is pushed to m again.
+    auto take(std::size_t m) -> std::span<int64_t>
+    {
+        auto const out = items(m);
+        sizes[m] = 0;
+        return out;
+    }
+
+    void push(std::size_t m, int64_t worry)
+    {
+        worries[m * capacity + sizes[m]++] = worry;
+    }
+};
+
+// Applies a monkey's operation to every item it's holding. Deciding which
+// operation it is once per turn, rather than once per item, leaves a simple
+// loop for each which the compiler can vectorise.
+auto inspect_all = [](monkey const& m, std::span<int64_t> items) {
+    auto const apply = [items](auto fn) {
+        for (int64_t& i : items) {
+            i = fn(i);
+        }
+    };
+
+    int64_t const arg = m.arg;
+    if (m.op == operation::add) {
+        if (arg < 0) {
+            apply([](int64_t i) { return i + i; });
+        } else {
+            apply([arg](int64_t i) { return i + arg; });
+        }
+    } else {
+        if (arg < 0) {
+            apply([](int64_t i) { return i * i; });
+        } else {
+            apply([arg](int64_t i) { return i * arg; });
+        }
+    }
+};
+
+template <bool Part1>
+auto do_round = [](std::vector<monkey> const& monkeys, item_queues& queues,
+                   std::vector<int64_t>& counts, fast_mod const& lcm) {
+
+    for (std::size_t m = 0; m < monkeys.size(); m++) {
+        auto const& monkey = monkeys[m];
+        auto const items = queues.items(m);
+        counts[m] += items.size();
+
+        // Monkey inspects items
+        inspect_all(monkey, items);
 
-            // Monkey puts item down
+        // Monkey puts items down
+        for (int64_t& i : items) {
             if constexpr (Part1) {
                 i /= 3;
             } else {
-                i %= lcm;
+                i = lcm(i);
             }
+        }
 
-            // Throw to other monkey
-            int dest = (i % monkey.divisor) == 0 ? monkey.true_dest : monkey.false_dest;
-            monkeys.at(dest).items.push_back(i);
+        // Throw to other monkeys. A monkey never throws to itself, so this
+        // doesn't overwrite the items we're reading.
+        for (int64_t i : queues.take(m)) {
+            std::size_t const dest = monkey.divisor_mod(i) == 0 ? monkey.true_dest : monkey.false_dest;
+            assert(dest != m);
+            queues.push(dest, i);
         }
+    }
 
-        monkey.items.clear();
+};
+
+template <bool Part1>
+auto count_inspections_by_round = [](std::vector<monkey> const& monkeys, int64_t rounds) {
+    fast_mod const lcm(lcm_of_divisors(monkeys));
+    item_queues queues(monkeys);
+    std::vector<int64_t> counts(monkeys.size());
+
+    for (int64_t i = 0; i < rounds; i++) {
+        do_round<Part1>(monkeys, queues, counts, lcm);
     }
 
+    return counts;
+};
+
+auto part1 = [](std::vector<monkey> const& monkeys) -> int64_t {
+    return static_cast<int64_t>(monkey_business(count_inspections_by_round<true>(monkeys, 20)));
 };
 
-auto part1 = [](std::vector<monkey> monkeys) -> int64_t {
+/*
+ * For part 2 the items never affect each other: where an item goes next only
+ * depends on which monkey has it and its worry level (mod lcm). So we can
+ * follow each item through all the rounds on its own.
+ *
+ * An item's state at the start of a round can only take finitely many values,
+ * so eventually it must repeat, after which the item goes round the same
+ * cycle of rounds forever. We look for that using Brent's algorithm, which
+ * only needs to remember one earlier state (and moves it ahead to the current
+ * one after 1, 2, 4, 8... rounds). Once the current state matches it, we know
+ * the cycle length and that the item is somewhere on the cycle, so we only
+ * need to simulate one more trip around the cycle to know the inspection
+ * counts for all the rest.
+ */
+struct item_state {
+    int monkey;
+    int64_t worry;
+
+    bool operator==(item_state const&) const = default;
+};
 
-    for (int i = 0; i < 20; i++) {
-        do_round<true>(monkeys);
+// Follows an item through a single round, adding its inspections to counts.
+// Monkeys take their turns in order, so an item thrown to a later monkey gets
+// inspected again in the same round.
+//
+// The remainders can be computed with either plain divisions or fast_mod,
+// for comparison.
+template <bool FastMod>
+auto item_round = [](std::vector<monkey> const& monkeys, fast_mod const& lcm,
+                     item_state s, std::vector<int64_t>& counts) -> item_state {
+    while (true) {
+        auto const& m = monkeys[s.monkey];
+        ++counts[s.monkey];
+        bool divisible;
+        if constexpr (FastMod) {
+            s.worry = lcm(inspect(m, s.worry));
+            divisible = m.divisor_mod(s.worry) == 0;
+        } else {
+            s.worry = inspect(m, s.worry) % lcm.d;
+            divisible = s.worry % m.divisor == 0;
+        }
+        int const dest = divisible ? m.true_dest : m.false_dest;
+        bool const next_round = dest < s.monkey;
+        s.monkey = dest;
+        if (next_round) {
+            return s;
+        }
     }
+};
 
-    return flux::from(monkeys)
-                .map(&monkey::count)
-                ._(max_n<2>)
-                .product();
+// Adds the inspections of a single item over the given number of rounds
+template <bool FastMod>
+auto follow_item = [](std::vector<monkey> const& monkeys, fast_mod const& lcm,
+                      item_state s, int64_t rounds, std::vector<int64_t>& counts) {
+    item_state saved = s;
+    int64_t power = 1;
+    int64_t period = 0;
+
+    for (int64_t round = 0; round < rounds; ) {
+        s = item_round<FastMod>(monkeys, lcm, s, counts);
+        ++round;
+        ++period;
+
+        if (s == saved) {
+            int64_t const remaining = rounds - round;
+            std::vector<int64_t> per_cycle(monkeys.size());
+            for (int64_t i = 0; i < period; i++) {
+                s = item_round<FastMod>(monkeys, lcm, s, per_cycle);
+            }
+            for (std::size_t m = 0; m < counts.size(); m++) {
+                counts[m] += per_cycle[m] * (remaining / period);
+            }
+            for (int64_t i = 0; i < remaining % period; i++) {
+                s = item_round<FastMod>(monkeys, lcm, s, counts);
+            }
+            return;
+        }
+
+        if (period == power) {
+            saved = s;
+            power *= 2;
+            period = 0;
+        }
+    }
 };
 
-auto part2 = [](std::vector<monkey> monkeys) -> int64_t {
+// Since items are independent, they can be shared out between threads. Each
+// thread grabs a batch of items at a time and keeps its own counts, which
+// are added together at the end.
+template <bool FastMod = true>
+auto count_inspections = [](std::vector<monkey> const& monkeys, int64_t rounds,
+                            int n_threads = 1) -> std::vector<int64_t>
+{
+    constexpr int batch_sz = 16;
+
+    int64_t const lcm_value = lcm_of_divisors(monkeys);
+    fast_mod const lcm(lcm_value);
 
-    int64_t lcm = flux::ref(monkeys).map(&monkey::divisor).product();
+    std::vector<item_state> items;
+    for (int m = 0; m < std::ssize(monkeys); m++) {
+        for (int64_t const worry : monkeys[m].items) {
+            items.push_back({m, worry % lcm_value});
+        }
+    }
+
+    std::vector<std::vector<int64_t>> thread_counts(n_threads, std::vector<int64_t>(monkeys.size()));
+    std::atomic<std::size_t> next_batch{0};
 
-    for (int i = 0; i < 10'000; i++) {
-        do_round<false>(monkeys, lcm);
+    auto worker = [&](std::vector<int64_t>& counts) {
+        for (std::size_t b = next_batch++; b * batch_sz < items.size(); b = next_batch++) {
+            auto const end = std::min(items.size(), (b + 1) * batch_sz);
+            for (std::size_t i = b * batch_sz; i < end; i++) {
+                follow_item<FastMod>(monkeys, lcm, items[i], rounds, counts);
+            }
+        }
+    };
+
+    if (n_threads <= 1) {
+        worker(thread_counts[0]);
+    } else {
+        std::vector<std::jthread> threads;
+        for (auto& counts : thread_counts) {
+            threads.emplace_back(worker, std::ref(counts));
+        }
     }
 
-    return flux::from(monkeys)
-                .map(&monkey::count)
-                ._(max_n<2>)
-                .product();
+    return flux::from(std::move(thread_counts))
+            .fold([](auto acc, auto const& counts) {
+                for (std::size_t m = 0; m < acc.size(); m++) {
+                    acc[m] += counts[m];
+                }
+                return acc;
+            }, std::vector<int64_t>(monkeys.size()));
+};
+
+auto part2 = [](std::vector<monkey> const& monkeys) -> int64_t {
+    return static_cast<int64_t>(monkey_business(count_inspections<>(monkeys, 10'000)));
 };
 
 constexpr auto& test_input =
@@ -161,12 +411,72 @@ Monkey 3:
     If true: throw to monkey 0
     If false: throw to monkey 1)";
 
+// Times part 2 round by round, then item by item using plain division and
+// using fast_mod with increasing numbers of threads, on randomly generated
+// monkeys which each start with the same number of items
+auto benchmark = [](int n_monkeys, int items_per_monkey) {
+    constexpr std::array primes{2, 3, 5, 7, 11, 13, 17, 19};
+
+    std::mt19937 gen(11);
+    auto const random = [&](int lo, int hi) {
+        return std::uniform_int_distribution<int>(lo, hi)(gen);
+    };
+
+    std::vector<monkey> monkeys(n_monkeys);
+    for (int i = 0; i < n_monkeys; i++) {
+        auto& m = monkeys[i];
+        for (int j = 0; j < items_per_monkey; j++) {
+            m.items.push_back(random(50, 99));
+        }
+        m.op = random(0, 1) ? operation::add : operation::multiply;
+        m.arg = random(0, 3) == 0 ? -1 : random(1, 19);
+        // Only the first few primes, so the lcm doesn't overflow
+        m.divisor = primes[i % primes.size()];
+        m.divisor_mod = fast_mod(m.divisor);
+        do {
+            m.true_dest = random(0, n_monkeys - 1);
+            m.false_dest = random(0, n_monkeys - 1);
+        } while (m.true_dest == i || m.false_dest == i || m.true_dest == m.false_dest);
+    }
+
+    aoc::timer t;
+    auto const expected = count_inspections_by_round<false>(monkeys, 10'000);
+    fmt::print("By round: {} ({})\n", monkey_business(expected),
+               t.elapsed<std::chrono::milliseconds>());
+
+    t.reset();
+    auto const by_division = count_inspections<false>(monkeys, 10'000);
+    fmt::print("Division: {} ({})\n", monkey_business(by_division),
+               t.elapsed<std::chrono::milliseconds>());
+    assert(by_division == expected);
+
+    int const max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+        t.reset();
+        auto const counts = count_inspections<true>(monkeys, 10'000, n_threads);
+        auto const elapsed = t.elapsed<std::chrono::milliseconds>();
+        assert(counts == expected);
+        fmt::print("fast_mod, {} threads: {} ({})\n", n_threads, monkey_business(counts), elapsed);
+    }
+};
+
 int main(int argc, char** argv)
 {
     {
         auto const test_monkeys = parse_input(test_input);
         assert(part1(test_monkeys) == 10605);
         assert(part2(test_monkeys) == 2713310158);
+        for (int64_t rounds : {1, 20, 1000, 10'000}) {
+            assert(count_inspections<>(test_monkeys, rounds) ==
+                   count_inspections_by_round<false>(test_monkeys, rounds));
+        }
+        assert(count_inspections<>(test_monkeys, 10'000, 3) ==
+               count_inspections_by_round<false>(test_monkeys, 10'000));
+    }
+
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(64, 50);
+        return 0;
     }
 
     if (argc < 2) {
@@ -179,4 +489,11 @@ int main(int argc, char** argv)
 
     fmt::print("Part 1: {}\n", part1(monkeys));
     fmt::print("Part 2: {}\n", part2(monkeys));
+
+    // Optionally, part 2 with a different number of rounds
+    if (argc > 2) {
+        auto const rounds = aoc::try_parse<int64_t>(std::string_view(argv[2])).value();
+        fmt::print("Part 2 after {} rounds: {}\n", rounds,
+                   monkey_business(count_inspections<>(monkeys, rounds)));
+    }
 }
\ No newline at end of file
@@ -3,29 +3,8 @@
 
 #include "../extern/ctre.hpp"
 
-/*
- * Flux polyfills
- */
-
-auto flat_map = []<flux::sequence Seq, typename Func>(Seq seq, Func func)
-    -> flux::generator<flux::element_t<std::invoke_result_t<Func&, flux::element_t<Seq>>>>
-{
-    FLUX_FOR(auto&& elem, flux::map(std::move(seq), std::move(func))) {
-        FLUX_FOR(auto&& inner, FLUX_FWD(elem)) {
-            co_yield FLUX_FWD(inner);
-        }
-    }
-};
-
-auto front = []<typename Seq>(Seq&& seq) -> std::optional<flux::value_t<Seq>>
-{
-    auto cur = flux::first(seq);
-    if (!flux::is_last(seq, cur)) {
-        return std::optional<flux::value_t<Seq>>(std::in_place, flux::read_at(seq, cur));
-    } else {
-        return std::nullopt;
-    }
-};
+#include <atomic>
+#include <thread>
 
 /*
  * Solution code
@@ -51,17 +30,19 @@ constexpr auto& regex = R"(Sensor at x=(-?\d+), y=(-?\d+): closest beacon is at
 
 auto to_int = [](std::string_view sv) { return aoc::try_parse<int>(sv).value(); };
 
-auto parse_input = [](std::string_view input) -> std::vector<sensor>
+// A plain loop rather than flux::to, so that this works in constant
+// expressions too
+constexpr auto parse_input = [](std::string_view input) -> std::vector<sensor>
 {
-    return flux::from(ctre::tokenize<regex>(input))
-            .map([](auto match) {
-                auto [_, x0, y0, x1, y1] = match;
-                return sensor {
-                    .pos = {.x = to_int(x0), .y = to_int(y0)},
-                    .beacon = {.x = to_int(x1), .y = to_int(y1)}
-                };
-            })
-            .to<std::vector>();
+    std::vector<sensor> sensors;
+    for (auto match : ctre::tokenize<regex>(input)) {
+        auto [_, x0, y0, x1, y1] = match;
+        sensors.push_back({
+            .pos = {.x = to_int(x0), .y = to_int(y0)},
+            .beacon = {.x = to_int(x1), .y = to_int(y1)}
+        });
+    }
+    return sensors;
 };
 
 auto potential_beacon = [](auto const& sensors, coord pos) -> bool {
@@ -73,44 +54,234 @@ auto potential_beacon = [](auto const& sensors, coord pos) -> bool {
     return flux::none(sensors, within_min_distance);
 };
 
-template <int Row>
-auto part1 = [](auto const& sensors) {
+// An inclusive range of x coordinates
+struct interval {
+    int lo = 0;
+    int hi = 0;
+
+    friend auto operator==(interval, interval) -> bool = default;
+    friend auto operator<=>(interval, interval) = default;
+};
 
-    auto x_min = flux::ref(sensors)
-                    .map([](auto s) { return s.pos.x - distance(s.pos, s.beacon); })
-                    .min().value();
+/*
+ * Each sensor covers a (possibly empty) interval of the given row. Sorting
+ * these by their start point lets us merge overlapping and adjacent
+ * intervals in a single pass, so the cost depends only on the number of
+ * sensors and not on the distances involved.
+ */
+auto row_coverage = [](auto const& sensors, int row) -> std::vector<interval>
+{
+    std::vector<interval> intervals;
+    intervals.reserve(flux::size(sensors));
 
-    auto x_max = flux::ref(sensors)
-                    .map([](auto s) { return s.pos.x + distance(s.pos, s.beacon); })
-                    .max().value();
+    for (auto const& [pos, beacon] : sensors) {
+        int const half_width = distance(pos, beacon) - std::abs(pos.y - row);
+        if (half_width >= 0) {
+            intervals.push_back({pos.x - half_width, pos.x + half_width});
+        }
+    }
 
-    return flux::ints(x_min, x_max)
-            .count_if([&](int x) { return !potential_beacon(sensors, {x, Row}); });
+    flux::sort(intervals);
+
+    std::vector<interval> merged;
+    for (interval i : intervals) {
+        if (!merged.empty() && i.lo <= merged.back().hi + 1) {
+            merged.back().hi = std::max(merged.back().hi, i.hi);
+        } else {
+            merged.push_back(i);
+        }
+    }
+
+    return merged;
+};
+
+template <int Row>
+auto part1 = [](auto const& sensors) -> int64_t {
+    auto const covered = flux::from(row_coverage(sensors, Row))
+                            .map([](interval i) -> int64_t { return 1 + i.hi - i.lo; })
+                            .sum();
+
+    // Every beacon lies within its own sensor's range, so all of the beacons
+    // on this row have been counted as covered
+    auto beacons = flux::ref(sensors)
+                    .map([](auto const& s) { return s.beacon; })
+                    .filter([](coord b) { return b.y == Row; })
+                    .template to<std::vector<coord>>();
+    flux::sort(beacons);
+    auto const n_beacons = std::ranges::distance(beacons.begin(), std::ranges::unique(beacons).begin());
+
+    return covered - n_beacons;
 };
 
 template <int Max>
 auto in_bounds = [](coord c) { return c.x >= 0 && c.y <= Max && c.y >= 0 && c.x <= Max; };
 
-auto border_generator = [](sensor s) -> flux::generator<coord> {
-    auto [pos, beacon] = s;
+/*
+ * If there is exactly one uncovered point, it must lie just outside the
+ * edges of the sensors around it. Rotating by 45 degrees (u = x + y,
+ * v = x - y) turns each sensor's diamond into a square, whose edges lie on
+ * lines of constant u or v. Usually the point sits on a line which runs just
+ * outside one sensor's "high" edge and just outside another's "low" edge, so
+ * we first try the intersections of such lines.
+ *
+ * That misses points which are only bordered along one axis (for example at
+ * the edge of the search area), so if it finds nothing we walk along every
+ * edge of every sensor's enlarged square instead. Along a single line each
+ * sensor covers one interval, so each edge is a sort and a sweep.
+ */
+template <int Max>
+auto part2 = [](auto const& sensors) -> int64_t {
+    struct square { int u, v, r; };
+
+    std::vector<square> squares;
+    std::vector<int> u_low, u_high, v_low, v_high;
+
+    for (auto const& [pos, beacon] : sensors) {
+        int const r = distance(pos, beacon);
+        int const u = pos.x + pos.y;
+        int const v = pos.x - pos.y;
+        squares.push_back({u, v, r});
+        u_low.push_back(u - r - 1);
+        u_high.push_back(u + r + 1);
+        v_low.push_back(v - r - 1);
+        v_high.push_back(v + r + 1);
+    }
+
+    auto to_coord = [](int u, int v) { return coord{(u + v) / 2, (u - v) / 2}; };
+
+    auto sorted = [](std::vector<int> vec) { flux::sort(vec); return vec; };
+
+    auto shared_lines = [&](std::vector<int> const& low, std::vector<int> const& high) {
+        std::vector<int> out;
+        std::ranges::set_intersection(sorted(low), sorted(high), std::back_inserter(out));
+        return out;
+    };
+
+    auto search_intersections = [&](std::vector<int> const& us, std::vector<int> const& vs) -> std::optional<coord> {
+        for (int u : us) {
+            for (int v : vs) {
+                if ((u + v) % 2 == 0) {
+                    coord const c = to_coord(u, v);
+                    if (in_bounds<Max>(c) && potential_beacon(sensors, c)) {
+                        return c;
+                    }
+                }
+            }
+        }
+        return std::nullopt;
+    };
 
-    int dist = 1 + distance(pos, beacon);
+    /*
+     * Finds the first uncovered point on the line where u (or v, if
+     * !fixed_is_u) equals `line`, with the other coordinate in [lo, hi]. Only
+     * coordinates with the same parity as `line` correspond to grid points.
+     */
+    std::vector<interval> covered;
+    auto search_line = [&](int line, int lo, int hi, bool fixed_is_u) -> std::optional<coord> {
+        // The part of the line which lies within the search area
+        if (fixed_is_u) {
+            lo = std::max({lo, -line, line - 2 * Max});
+            hi = std::min({hi, 2 * Max - line, line});
+        } else {
+            lo = std::max({lo, line, -line});
+            hi = std::min({hi, 2 * Max + line, 2 * Max - line});
+        }
 
-    for (int d = 0; d <= 2*dist; d++) {
-        co_yield {pos.x - dist + d, pos.y - d};
-        co_yield {pos.x - dist + d, pos.y + d};
+        covered.clear();
+        for (auto [u, v, r] : squares) {
+            auto const [across, along] = fixed_is_u ? std::pair(u, v) : std::pair(v, u);
+            if (std::abs(line - across) <= r) {
+                covered.push_back({along - r, along + r});
+            }
+        }
+        flux::sort(covered);
+
+        auto align = [&](int t) { return (t - line) % 2 == 0 ? t : t + 1; };
+
+        int t = align(lo);
+        for (interval i : covered) {
+            if (t > hi || i.lo > t) {
+                break;
+            }
+            t = std::max(t, align(i.hi + 1));
+        }
+
+        if (t > hi) {
+            return std::nullopt;
+        }
+        return fixed_is_u ? to_coord(line, t) : to_coord(t, line);
+    };
+
+    auto search_edges = [&]() -> std::optional<coord> {
+        for (auto [u, v, r] : squares) {
+            int const d = r + 1;
+            for (int sign : {-1, 1}) {
+                if (auto c = search_line(u + sign * d, v - d, v + d, true)) {
+                    return c;
+                }
+                if (auto c = search_line(v + sign * d, u - d, u + d, false)) {
+                    return c;
+                }
+            }
+        }
+        return std::nullopt;
+    };
+
+    auto found = search_intersections(shared_lines(u_low, u_high), shared_lines(v_low, v_high));
+    if (!found) {
+        found = search_edges();
     }
+
+    return found ? found->x * 4'000'000LL + found->y : -1;
 };
 
+/*
+ * Finds every uncovered cell with 0 <= x, y <= Max, by running a row
+ * coverage query for every row. The rows are handed out to worker threads
+ * in fixed-size chunks, and each chunk's results are kept separately so
+ * that the output is in the same order regardless of scheduling.
+ */
 template <int Max>
-auto part2 = [](auto const& sensors) -> int64_t {
-    return flux::ref(sensors)
-                ._(flat_map, border_generator)
-                .filter(in_bounds<Max>)
-                .filter([&](coord c) { return potential_beacon(sensors, c); })
-                .map([](coord c) { return c.x * 4'000'000LL + c.y; })
-                ._(front)
-                .value_or(-1);
+auto find_gaps = [](auto const& sensors, int n_threads) -> std::vector<coord>
+{
+    constexpr int chunk_sz = 4096;
+    constexpr int n_chunks = (Max + chunk_sz) / chunk_sz;
+
+    std::vector<std::vector<coord>> results(n_chunks);
+    std::atomic<int> next_chunk{0};
+
+    auto worker = [&] {
+        for (int chunk = next_chunk++; chunk < n_chunks; chunk = next_chunk++) {
+            auto& out = results[chunk];
+            int const row_end = std::min(Max + 1, (chunk + 1) * chunk_sz);
+
+            for (int y = chunk * chunk_sz; y < row_end; y++) {
+                int x = 0;
+                for (interval i : row_coverage(sensors, y)) {
+                    for (; x < std::min(i.lo, Max + 1); x++) {
+                        out.push_back({x, y});
+                    }
+                    x = std::max(x, i.hi + 1);
+                }
+                for (; x <= Max; x++) {
+                    out.push_back({x, y});
+                }
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < n_threads; i++) {
+            threads.emplace_back(worker);
+        }
+    }
+
+    return flux::from(std::move(results))
+            .fold([](auto acc, auto const& vec) {
+                acc.insert(acc.end(), vec.begin(), vec.end());
+                return acc;
+            }, std::vector<coord>{});
 };
 
 constexpr auto test_data =
@@ -130,11 +301,23 @@ Sensor at x=14, y=3: closest beacon is at x=15, y=3
 Sensor at x=20, y=1: closest beacon is at x=15, y=3
 )";
 
-auto test = [] {
-    const auto sensors = parse_input(test_data);
-    assert(part1<10>(sensors) == 26);
-    assert(part2<20>(sensors) == 56000011);
-};
+constexpr auto test_part2_single_axis =
+R"(Sensor at x=44, y=4: closest beacon is at x=30, y=16
+Sensor at x=-4, y=0: closest beacon is at x=-19, y=6
+Sensor at x=18, y=36: closest beacon is at x=18, y=27
+Sensor at x=34, y=4: closest beacon is at x=38, y=-11
+Sensor at x=14, y=24: closest beacon is at x=14, y=34
+Sensor at x=30, y=-3: closest beacon is at x=25, y=-17
+Sensor at x=-3, y=21: closest beacon is at x=7, y=6
+Sensor at x=30, y=41: closest beacon is at x=42, y=56
+Sensor at x=12, y=20: closest beacon is at x=25, y=15
+)";
+
+static_assert(part1<10>(parse_input(test_data)) == 26);
+static_assert(part2<20>(parse_input(test_data)) == 56000011);
+// Here the only gap is bordered by u-lines alone, so it's not at an
+// intersection
+static_assert(part2<40>(parse_input(test_part2_single_axis)) == 15 * 4'000'000LL + 3);
 
 int main(int argc, char** argv)
 {
@@ -149,4 +332,25 @@ int main(int argc, char** argv)
 
     fmt::print("Part 1: {}\n", part1<2'000'000>(sensors));
     fmt::print("Part 2: {}\n", part2<4'000'000>(sensors));
+
+    if (argc > 2 && std::string_view(argv[2]) == "--gaps") {
+        constexpr int max = 4'000'000;
+        int const n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        if (find_gaps<20>(parse_input(test_data), n_threads) != std::vector<coord>{{14, 11}}) {
+            fmt::print(stderr, "find_gaps gave the wrong answer for the test data\n");
+            return 1;
+        }
+
+        aoc::timer t;
+        auto const gaps = find_gaps<max>(sensors, n_threads);
+        auto const elapsed = t.elapsed<std::chrono::duration<double>>();
+
+        for (coord c : gaps) {
+            fmt::print("Gap at x={}, y={}\n", c.x, c.y);
+        }
+        fmt::print("Checked {} rows in {} on {} threads ({:.0f} rows/s)\n",
+                   max + 1, std::chrono::duration_cast<std::chrono::milliseconds>(elapsed),
+                   n_threads, (max + 1) / elapsed.count());
+    }
 }
\ No newline at end of file
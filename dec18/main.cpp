@@ -2,21 +2,30 @@
 #include "../common.hpp"
 
 #include "../extern/ctre.hpp"
+#include "../extern/robin_hood.h"
+
+#include <bit>
+#include <cstdint>
+#include <random>
 
 struct vec3 {
     int x = 0, y = 0, z = 0;
 
     friend auto operator==(vec3 const&, vec3 const&) -> bool = default;
     friend auto operator<=>(vec3 const&, vec3 const&) = default;
-};
 
-using cubes_t = std::vector<vec3>;
+    friend constexpr auto operator+(vec3 lhs, vec3 rhs) -> vec3 {
+        return {lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z};
+    }
+};
 
-auto contains = [](cubes_t const& cubes, vec3 const& pos) {
-    return std::ranges::binary_search(cubes, pos);
+constexpr vec3 directions[] = {
+    {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
 };
 
-constexpr auto& regex = R"((\d+),(\d+),(\d+))";
+using cubes_t = std::vector<vec3>;
+
+constexpr auto& regex = R"((-?\d+),(-?\d+),(-?\d+))";
 
 auto parse_input = [](std::string_view input)
 {
@@ -37,76 +46,630 @@ auto parse_input = [](std::string_view input)
     return cubes;
 };
 
-auto get_neighbours = [](vec3 pos) {
-    return flux::from(std::array<vec3, 6>{
-        vec3{pos.x - 1, pos.y,     pos.z},
-            {pos.x + 1, pos.y,     pos.z},
-            {pos.x,     pos.y - 1, pos.z},
-            {pos.x,     pos.y + 1, pos.z},
-            {pos.x,     pos.y,     pos.z - 1},
-            {pos.x,     pos.y,     pos.z + 1}
-    });;
+/*
+ * A dense bit-packed voxel grid covering a box of space. Each row of voxels
+ * along the x axis is stored as a run of 64-bit words, so membership is a
+ * single bit test, and we can count adjacent pairs of voxels a word at a
+ * time by ANDing neighbouring rows (or a row with itself shifted by one).
+ */
+struct voxel_grid {
+    using word_t = std::uint64_t;
+    static constexpr int word_bits = 64;
+
+    vec3 origin; // coordinates of the first voxel
+    vec3 size;
+    int row_words = 0;
+    std::vector<word_t> bits;
+
+    constexpr voxel_grid(vec3 origin_, vec3 size_)
+        : origin(origin_),
+          size(size_),
+          row_words((size.x + word_bits - 1) / word_bits),
+          bits(row_words * size.y * size.z)
+    {}
+
+    constexpr auto in_bounds(vec3 p) const -> bool {
+        return p.x >= origin.x && p.x < origin.x + size.x &&
+               p.y >= origin.y && p.y < origin.y + size.y &&
+               p.z >= origin.z && p.z < origin.z + size.z;
+    }
+
+    constexpr auto row(int y, int z) -> word_t* {
+        return bits.data() + (z * size.y + y) * row_words;
+    }
+
+    constexpr auto row(int y, int z) const -> word_t const* {
+        return bits.data() + (z * size.y + y) * row_words;
+    }
+
+    constexpr auto test(vec3 p) const -> bool {
+        int const x = p.x - origin.x;
+        return (row(p.y - origin.y, p.z - origin.z)[x / word_bits] >> (x % word_bits)) & 1;
+    }
+
+    constexpr void set(vec3 p) {
+        int const x = p.x - origin.x;
+        row(p.y - origin.y, p.z - origin.z)[x / word_bits] |= word_t{1} << (x % word_bits);
+    }
 };
 
-auto int_rng = [](int max) { return flux::iota(0, max); };
+// Make a grid with an empty border around the cubes
+auto make_grid = [](cubes_t const& cubes) -> voxel_grid {
+    auto const [min_x, max_x] = flux::map(std::cref(cubes), &vec3::x).minmax().value();
+    auto const [min_y, max_y] = flux::map(std::cref(cubes), &vec3::y).minmax().value();
+    auto const [min_z, max_z] = flux::map(std::cref(cubes), &vec3::z).minmax().value();
 
-auto part1 = [](cubes_t const& cubes) -> int {
-    std::vector<int> faces(cubes.size(), 6);
+    voxel_grid grid(vec3{min_x - 1, min_y - 1, min_z - 1},
+                    vec3{max_x - min_x + 3, max_y - min_y + 3, max_z - min_z + 3});
+    for (vec3 c : cubes) {
+        grid.set(c);
+    }
+    return grid;
+};
 
-    int_rng(cubes.size()).for_each([&](int idx) {
-        flux::from(get_neighbours(cubes[idx]))
-            .filter([&](vec3 n) { return contains(cubes, n); })
-            .for_each([&](vec3) { --faces.at(idx); });
-    });
+/*
+ * Every cube has six faces, minus two for every pair of touching cubes.
+ * We find the touching pairs by ANDing each row with itself shifted along
+ * x, and with the neighbouring rows in y and z.
+ */
+auto dense_surface_area = [](voxel_grid const& grid) -> std::int64_t {
+    using word_t = voxel_grid::word_t;
+    auto const [_, size_y, size_z] = grid.size;
+    int const words = grid.row_words;
 
-    return flux::sum(faces);
+    std::int64_t n_cubes = 0;
+    std::int64_t n_touching = 0;
+
+    for (int z = 0; z < size_z; z++) {
+        for (int y = 0; y < size_y; y++) {
+            auto const* row = grid.row(y, z);
+            auto const* next_y = y + 1 < size_y ? grid.row(y + 1, z) : nullptr;
+            auto const* next_z = z + 1 < size_z ? grid.row(y, z + 1) : nullptr;
+
+            for (int i = 0; i < words; i++) {
+                word_t const w = row[i];
+                if (w == 0) {
+                    continue;
+                }
+                word_t const next_x = (w >> 1) | (i + 1 < words ? row[i + 1] << (voxel_grid::word_bits - 1) : 0);
+
+                n_cubes += std::popcount(w);
+                n_touching += std::popcount(w & next_x);
+                n_touching += next_y ? std::popcount(w & next_y[i]) : 0;
+                n_touching += next_z ? std::popcount(w & next_z[i]) : 0;
+            }
+        }
+    }
+
+    return 6 * n_cubes - 2 * n_touching;
 };
 
-auto find_bounds = [](cubes_t const& cubes) -> vec3 {
-    return vec3 {
-        .x = 2 + flux::max(cubes, {}, &vec3::x).value().x,
-        .y = 2 + flux::max(cubes, {}, &vec3::y).value().y,
-        .z = 2 + flux::max(cubes, {}, &vec3::z).value().z
+/*
+ * Flood fill the "steam" from a corner of the grid (which is guaranteed to be
+ * empty), counting the lava faces it touches as it goes.
+ *
+ * Rather than visiting one voxel at a time, we sweep over the grid a row at
+ * a time. Each row picks up steam from its four neighbouring rows, and then
+ * spreads it along the row through any empty voxels, using a parallel-prefix
+ * fill within each word and carrying between words. Every voxel which becomes
+ * steam has its lava neighbours counted once, at the moment it is added.
+ * Sweeps alternate between forwards and backwards through the grid, and we
+ * stop once a sweep finds nothing new.
+ */
+auto dense_exterior_area = [](voxel_grid const& lava) -> std::int64_t {
+    using word_t = voxel_grid::word_t;
+    constexpr int top = voxel_grid::word_bits - 1;
+
+    auto const [_, size_y, size_z] = lava.size;
+    int const words = lava.row_words;
+    word_t const last_mask = lava.size.x % voxel_grid::word_bits == 0
+                                ? ~word_t{0}
+                                : (word_t{1} << (lava.size.x % voxel_grid::word_bits)) - 1;
+
+    auto fill_up = [](word_t gen, word_t pro) {
+        gen |= pro & (gen << 1);  pro &= pro << 1;
+        gen |= pro & (gen << 2);  pro &= pro << 2;
+        gen |= pro & (gen << 4);  pro &= pro << 4;
+        gen |= pro & (gen << 8);  pro &= pro << 8;
+        gen |= pro & (gen << 16); pro &= pro << 16;
+        gen |= pro & (gen << 32);
+        return gen;
     };
+
+    auto fill_down = [](word_t gen, word_t pro) {
+        gen |= pro & (gen >> 1);  pro &= pro >> 1;
+        gen |= pro & (gen >> 2);  pro &= pro >> 2;
+        gen |= pro & (gen >> 4);  pro &= pro >> 4;
+        gen |= pro & (gen >> 8);  pro &= pro >> 8;
+        gen |= pro & (gen >> 16); pro &= pro >> 16;
+        gen |= pro & (gen >> 32);
+        return gen;
+    };
+
+    auto steam = voxel_grid(lava.origin, lava.size);
+
+    std::int64_t faces = 0;
+    std::vector<word_t> row_buf(words);
+
+    auto update_row = [&](int y, int z) -> bool {
+        auto* s = steam.row(y, z);
+        auto const* l = lava.row(y, z);
+
+        std::array<word_t const*, 4> const adjacent{
+            y > 0 ? steam.row(y - 1, z) : nullptr,
+            y + 1 < size_y ? steam.row(y + 1, z) : nullptr,
+            z > 0 ? steam.row(y, z - 1) : nullptr,
+            z + 1 < size_z ? steam.row(y, z + 1) : nullptr
+        };
+
+        auto free = [&](int i) { return ~l[i] & (i == words - 1 ? last_mask : ~word_t{0}); };
+
+        // Pick up steam from the neighbouring rows, and spread it upwards...
+        word_t carry = 0;
+        for (int i = 0; i < words; i++) {
+            // The very first voxel is where we start from
+            word_t seed = s[i] | (y == 0 && z == 0 && i == 0);
+            for (auto const* adj : adjacent) {
+                seed |= adj ? adj[i] : 0;
+            }
+            row_buf[i] = fill_up((seed & free(i)) | (carry & free(i)), free(i));
+            carry = row_buf[i] >> top;
+        }
+
+        // ...and then downwards
+        carry = 0;
+        for (int i = words - 1; i >= 0; i--) {
+            row_buf[i] = fill_down(row_buf[i] | (carry & free(i)), free(i));
+            carry = (row_buf[i] & 1) << top;
+        }
+
+        bool changed = false;
+        for (int i = 0; i < words; i++) {
+            word_t const added = row_buf[i] & ~s[i];
+            if (added == 0) {
+                continue;
+            }
+            changed = true;
+            s[i] |= added;
+
+            word_t const lava_below = (l[i] << 1) | (i > 0 ? l[i - 1] >> top : 0);
+            word_t const lava_above = (l[i] >> 1) | (i + 1 < words ? l[i + 1] << top : 0);
+            faces += std::popcount(added & lava_below) + std::popcount(added & lava_above);
+
+            if (y > 0) { faces += std::popcount(added & lava.row(y - 1, z)[i]); }
+            if (y + 1 < size_y) { faces += std::popcount(added & lava.row(y + 1, z)[i]); }
+            if (z > 0) { faces += std::popcount(added & lava.row(y, z - 1)[i]); }
+            if (z + 1 < size_z) { faces += std::popcount(added & lava.row(y, z + 1)[i]); }
+        }
+
+        return changed;
+    };
+
+    for (bool forwards = true; ; forwards = !forwards) {
+        bool changed = false;
+        for (int n = 0; n < size_y * size_z; n++) {
+            int const r = forwards ? n : size_y * size_z - 1 - n;
+            changed |= update_row(r % size_y, r / size_y);
+        }
+        if (!changed) {
+            break;
+        }
+    }
+
+    return faces;
+};
+
+/*
+ * Sparse storage
+ *
+ * For inputs spread over a huge range of coordinates we instead split space
+ * into 16x16x16 bricks, and only store the bricks which contain some lava,
+ * in a hash map keyed by brick coordinate. Memory use then depends on how
+ * much of space is occupied rather than on the size of the bounding box.
+ */
+struct vec3_hash {
+    auto operator()(vec3 const& v) const noexcept -> std::size_t {
+        auto const u = [](int i) { return std::uint64_t(std::uint32_t(i)); };
+        return robin_hood::hash_int(u(v.x) ^ (u(v.y) << 21) ^ (u(v.z) << 42));
+    }
+};
+
+// Whether a padded grid around the cubes would have at most max_voxels voxels
+auto fits_in = [](cubes_t const& cubes, std::int64_t max_voxels) -> bool {
+    std::int64_t volume = 1;
+    for (auto proj : {&vec3::x, &vec3::y, &vec3::z}) {
+        auto const [lo, hi] = flux::map(std::cref(cubes), proj).minmax().value();
+        volume *= std::int64_t{hi} - lo + 3;
+        if (volume > max_voxels) {
+            return false;
+        }
+    }
+    return true;
+};
+
+template <typename T>
+using brick_map = robin_hood::unordered_flat_map<vec3, T, vec3_hash>;
+using cell_set = robin_hood::unordered_flat_set<vec3, vec3_hash>;
+
+struct brick {
+    static constexpr int shift = 4;
+    static constexpr int side = 1 << shift;
+
+    std::array<std::uint64_t, side * side * side / 64> bits{};
+
+    static constexpr auto key_of(vec3 p) -> vec3 {
+        return {p.x >> shift, p.y >> shift, p.z >> shift};
+    }
+
+    static constexpr auto index_of(vec3 p) -> int {
+        constexpr int mask = side - 1;
+        return (p.x & mask) + side * ((p.y & mask) + side * (p.z & mask));
+    }
+
+    constexpr auto test(vec3 p) const -> bool {
+        int const i = index_of(p);
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    constexpr void set(vec3 p) {
+        int const i = index_of(p);
+        bits[i / 64] |= std::uint64_t{1} << (i % 64);
+    }
+};
+
+struct sparse_voxels {
+    brick_map<brick> bricks;
+
+    auto test(vec3 p) const -> bool {
+        auto const it = bricks.find(brick::key_of(p));
+        return it != bricks.end() && it->second.test(p);
+    }
+
+    void set(vec3 p) { bricks[brick::key_of(p)].set(p); }
+};
+
+auto make_sparse = [](cubes_t const& cubes) -> sparse_voxels {
+    sparse_voxels voxels;
+    for (vec3 c : cubes) {
+        voxels.set(c);
+    }
+    return voxels;
+};
+
+auto sparse_surface_area = [](sparse_voxels const& lava) -> std::int64_t {
+    std::int64_t faces = 0;
+
+    for (auto const& [key, b] : lava.bricks) {
+        vec3 const base{key.x * brick::side, key.y * brick::side, key.z * brick::side};
+
+        for (int w = 0; w < (int) b.bits.size(); w++) {
+            for (auto bits = b.bits[w]; bits != 0; bits &= bits - 1) {
+                int const i = w * 64 + std::countr_zero(bits);
+                vec3 const p = base + vec3{i % brick::side, (i / brick::side) % brick::side, i / (brick::side * brick::side)};
+                faces += flux::count_if(directions, [&](vec3 d) { return !lava.test(p + d); });
+            }
+        }
+    }
+
+    return faces;
+};
+
+// The steam within bricks containing lava, and the empty bricks which are
+// entirely filled with steam
+struct sparse_steam {
+    brick_map<brick> partial;
+    cell_set full;
+
+    auto test(vec3 p) const -> bool {
+        auto const key = brick::key_of(p);
+        if (auto const it = partial.find(key); it != partial.end()) {
+            return it->second.test(p);
+        }
+        return full.contains(key);
+    }
 };
 
-auto part2 = [](cubes_t const& cubes) -> int {
-    auto const [x_max, y_max, z_max] = find_bounds(cubes);
+auto sparse_flood(sparse_voxels const& lava, std::int64_t& faces) -> sparse_steam;
 
-    auto in_bounds = [&](vec3 p) {
-        return p.x >= 0 && p.x < x_max && p.y >= 0 && p.y < y_max && p.z >= 0 && p.z < z_max;
+/*
+ * Given a set of cells, finds the empty cells next to them which are
+ * connected to the outside. If the cells are close together we can just do a
+ * dense flood fill; otherwise we treat them as lava and do a sparse one.
+ */
+auto exterior_neighbours(cubes_t const& cells) -> cell_set
+{
+    constexpr std::int64_t max_dense_cells = std::int64_t{1} << 24;
+
+    cell_set out;
+    auto add_if_exterior = [&](auto const& is_filled, auto const& is_steam) {
+        for (vec3 c : cells) {
+            for (vec3 d : directions) {
+                if (!is_filled(c + d) && is_steam(c + d)) {
+                    out.insert(c + d);
+                }
+            }
+        }
+    };
+
+    if (fits_in(cells, max_dense_cells)) {
+        auto const filled = make_grid(cells);
+        auto steam = voxel_grid(filled.origin, filled.size);
+
+        std::vector<vec3> queue{filled.origin};
+        steam.set(filled.origin);
+
+        while (!queue.empty()) {
+            vec3 const pos = queue.back();
+            queue.pop_back();
+
+            for (vec3 d : directions) {
+                vec3 const n = pos + d;
+                if (filled.in_bounds(n) && !steam.test(n) && !filled.test(n)) {
+                    steam.set(n);
+                    queue.push_back(n);
+                }
+            }
+        }
+
+        add_if_exterior([&](vec3 p) { return filled.test(p); },
+                        [&](vec3 p) { return steam.test(p); });
+    } else {
+        auto const filled = make_sparse(cells);
+        std::int64_t unused = 0;
+        auto const steam = sparse_flood(filled, unused);
+
+        add_if_exterior([&](vec3 p) { return filled.test(p); },
+                        [&](vec3 p) { return steam.test(p); });
+    }
+
+    return out;
+}
+
+/*
+ * Bit-parallel operations on whole bricks. A brick's 4096 bits are stored
+ * with x varying fastest, so each 64-bit word holds four rows of x for one
+ * z, and each group of four words makes up one z-plane.
+ */
+namespace brick_ops {
+
+using word_t = std::uint64_t;
+constexpr int n_words = std::tuple_size_v<decltype(brick::bits)>;
+constexpr int words_per_plane = brick::side * brick::side / 64;
+constexpr int row_bits = brick::side;
+constexpr word_t low_x = 0x0001'0001'0001'0001; // voxels with x == 0
+constexpr word_t high_x = low_x << (brick::side - 1); // voxels with x == 15
+constexpr word_t low_row = 0xFFFF; // the first row in a word
+constexpr word_t high_row = low_row << (64 - row_bits); // the last row in a word
+
+// For each voxel p, whether b contains p + d, for each of the six directions
+constexpr auto neighbour_in = [](brick const& b, int dir) -> brick {
+    brick out;
+    for (int w = 0; w < n_words; w++) {
+        int const plane_pos = w % words_per_plane;
+        word_t& o = out.bits[w];
+        switch (dir) {
+        case 0: o = (b.bits[w] << 1) & ~low_x; break;
+        case 1: o = (b.bits[w] >> 1) & ~high_x; break;
+        case 2: o = (b.bits[w] << row_bits) | (plane_pos > 0 ? b.bits[w - 1] >> (64 - row_bits) : 0); break;
+        case 3: o = (b.bits[w] >> row_bits) | (plane_pos < words_per_plane - 1 ? b.bits[w + 1] << (64 - row_bits) : 0); break;
+        case 4: o = w >= words_per_plane ? b.bits[w - words_per_plane] : 0; break;
+        case 5: o = w + words_per_plane < n_words ? b.bits[w + words_per_plane] : 0; break;
+        }
+    }
+    return out;
+};
+
+// The voxels of b on the face in direction d, moved to where they would
+// touch the neighbouring brick in that direction
+constexpr auto across = [](brick const& b, int dir) -> brick {
+    brick out;
+    for (int w = 0; w < n_words; w++) {
+        int const plane_pos = w % words_per_plane;
+        word_t& o = out.bits[w];
+        switch (dir) {
+        case 0: o = (b.bits[w] & low_x) << (brick::side - 1); break;
+        case 1: o = (b.bits[w] & high_x) >> (brick::side - 1); break;
+        case 2: o = plane_pos == words_per_plane - 1 ? (b.bits[w - plane_pos] & low_row) << (64 - row_bits) : 0; break;
+        case 3: o = plane_pos == 0 ? b.bits[w + words_per_plane - 1] >> (64 - row_bits) : 0; break;
+        case 4: o = w + words_per_plane >= n_words ? b.bits[w + words_per_plane - n_words] : 0; break;
+        case 5: o = w < words_per_plane ? b.bits[w + n_words - words_per_plane] : 0; break;
+        }
+    }
+    return out;
+};
+
+constexpr auto popcount = [](brick const& b) -> int {
+    return flux::ref(b.bits).map([](word_t w) { return std::popcount(w); }).sum();
+};
+
+constexpr auto any = [](brick const& b) -> bool {
+    return flux::any(b.bits, [](word_t w) { return w != 0; });
+};
+
+constexpr auto binary_op = [](brick a, brick const& b, auto op) -> brick {
+    for (int w = 0; w < n_words; w++) {
+        a.bits[w] = op(a.bits[w], b.bits[w]);
+    }
+    return a;
+};
+
+constexpr auto and_ = [](brick const& a, brick const& b) { return binary_op(a, b, std::bit_and{}); };
+constexpr auto or_ = [](brick const& a, brick const& b) { return binary_op(a, b, std::bit_or{}); };
+constexpr auto and_not = [](brick const& a, brick const& b) {
+    return binary_op(a, b, [](word_t x, word_t y) { return x & ~y; });
+};
+
+constexpr auto full = [] {
+    brick b;
+    b.bits.fill(~word_t{0});
+    return b;
+}();
+
+}
+
+/*
+ * Flood fills steam through a sparse voxel store, counting the lava faces it
+ * touches.
+ *
+ * Empty bricks (those not in the store) are either connected to the outside
+ * or are part of an enclosed pocket. Finding out which is the same problem
+ * as the one we're solving, just with bricks rather than voxels, so we solve
+ * it recursively for the empty bricks next to the lava. Those that are
+ * outside are filled with steam, which seeps into the faces of the lava
+ * bricks next to them.
+ *
+ * Within a lava brick, the steam spreads a whole brick at a time by
+ * repeatedly growing it in all six directions (using shifts) until it stops
+ * changing. Whatever reaches the faces of the brick seeds its neighbours. If
+ * steam breaks into an enclosed empty brick, the whole of that pocket fills
+ * up at once.
+ */
+auto sparse_flood(sparse_voxels const& lava, std::int64_t& faces) -> sparse_steam
+{
+    using namespace brick_ops;
+
+    struct work {
+        vec3 key;
+        brick const* lava = nullptr;
+        brick steam;
+        brick pending;
+        bool queued = false;
+    };
+
+    brick_map<work> works;
+    for (auto const& [key, b] : lava.bricks) {
+        works[key] = work{.key = key, .lava = &b, .steam = {}, .pending = {}};
+    }
+
+    std::vector<work*> queue;
+
+    // Steam has arrived at the given voxels of a neighbouring brick
+    auto seep_into = [&](vec3 key, brick const& arriving) {
+        auto const it = works.find(key);
+        work& w = it->second;
+        faces += popcount(and_(arriving, *w.lava));
+        w.pending = or_(w.pending, and_not(arriving, *w.lava));
+        if (!w.queued) {
+            w.queued = true;
+            queue.push_back(&w);
+        }
     };
 
-    // Starting at {0, 0, 0}, expand the "steam" in six directions,
-    // ignoring out-of-bounds positions, positions we have already visited,
-    // and places where cubes lie
-    auto steam = std::vector<bool>(x_max * y_max * z_max, false);
+    // Fill an empty brick with steam, and let it seep into the lava bricks
+    // next to it
+    sparse_steam steam;
+    auto fill_brick = [&](vec3 key) {
+        if (!steam.full.insert(key).second) {
+            return;
+        }
+        for (int d = 0; d < 6; d++) {
+            if (lava.bricks.contains(key + directions[d])) {
+                seep_into(key + directions[d], across(full, d));
+            }
+        }
+    };
 
-    auto visited = [&](vec3 pos) -> decltype(auto) {
-        return steam.at((pos.z * y_max * x_max) + (pos.y * x_max) + pos.x);
+    auto fill_pocket = [&](vec3 start) {
+        std::vector<vec3> pocket{start};
+        cell_set seen{start};
+        while (!pocket.empty()) {
+            vec3 const k = pocket.back();
+            pocket.pop_back();
+            fill_brick(k);
+            for (vec3 d : directions) {
+                if (!lava.bricks.contains(k + d) && seen.insert(k + d).second) {
+                    pocket.push_back(k + d);
+                }
+            }
+        }
     };
 
-    std::vector<vec3> queue{vec3{0, 0, 0}};
+    auto const keys = flux::ref(lava.bricks).map([](auto const& kv) { return kv.first; }).to<cubes_t>();
+    for (vec3 key : exterior_neighbours(keys)) {
+        fill_brick(key);
+    }
 
     while (!queue.empty()) {
-        vec3 pos = queue.back();
+        work& w = *queue.back();
         queue.pop_back();
-        visited(pos) = true;
+        w.queued = false;
 
-        get_neighbours(pos)
-            .filter([&](vec3 n) {
-                return in_bounds(n) && !visited(n) && !contains(cubes, n);
-            })
-            .for_each([&](vec3 n) { queue.push_back(n); });
+        brick const allowed = and_not(and_not(full, *w.lava), w.steam);
+        brick added = and_(w.pending, allowed);
+        w.pending = brick{};
+
+        if (!any(added)) {
+            continue;
+        }
+
+        while (true) {
+            brick grown = added;
+            for (int d = 0; d < 6; d++) {
+                grown = or_(grown, neighbour_in(added, d));
+            }
+            grown = and_(grown, allowed);
+            if (grown.bits == added.bits) {
+                break;
+            }
+            added = grown;
+        }
+
+        w.steam = or_(w.steam, added);
+
+        for (int d = 0; d < 6; d++) {
+            faces += popcount(and_(added, neighbour_in(*w.lava, d)));
+
+            brick const boundary = across(added, d);
+            if (!any(boundary)) {
+                continue;
+            }
+
+            vec3 const next = w.key + directions[d];
+            if (lava.bricks.contains(next)) {
+                seep_into(next, boundary);
+            } else if (!steam.full.contains(next)) {
+                // We've broken into an enclosed pocket: fill all of it
+                fill_pocket(next);
+            }
+        }
     }
 
-    // Now build another cube set of the empty spaces and do part 1 again
-    cubes_t new_cubes = flux::cartesian_product(int_rng(x_max), int_rng(y_max), int_rng(z_max))
-                        .map([](auto tuple) { auto [i, j, k] = tuple; return vec3{i, j, k}; })
-                        .filter(std::not_fn(visited))
-                        .to<cubes_t>();
+    for (auto& [key, w] : works) {
+        steam.partial[key] = w.steam;
+    }
+
+    return steam;
+}
+
+auto sparse_exterior_area = [](sparse_voxels const& lava) -> std::int64_t {
+    std::int64_t faces = 0;
+    sparse_flood(lava, faces);
+    return faces;
+};
+
+template <typename... Fs>
+struct overloaded : Fs... {
+    using Fs::operator()...;
+};
+
+auto surface_area = overloaded{dense_surface_area, sparse_surface_area};
+auto exterior_area = overloaded{dense_exterior_area, sparse_exterior_area};
+
+// Use the dense representation unless it would take more than about 128MB.
+// Part 2 needs a second grid of the same size for the steam, so it gets half
+// as many voxels per grid.
+constexpr std::int64_t max_dense_voxels = std::int64_t{1} << 30;
 
-    return part1(std::move(new_cubes));
+auto use_dense = [](cubes_t const& cubes, int n_grids) -> bool {
+    return fits_in(cubes, max_dense_voxels / n_grids);
+};
+
+auto part1 = [](cubes_t const& cubes) -> std::int64_t {
+    return use_dense(cubes, 1) ? surface_area(make_grid(cubes)) : surface_area(make_sparse(cubes));
+};
+
+auto part2 = [](cubes_t const& cubes) -> std::int64_t {
+    return use_dense(cubes, 2) ? exterior_area(make_grid(cubes)) : exterior_area(make_sparse(cubes));
 };
 
 constexpr auto test_data =
@@ -126,13 +689,108 @@ R"(2,2,2
 
 auto test = [] {
     auto const test_cubes = parse_input(test_data);
-    return part1(test_cubes) == 64;
-    return part2(test_cubes) == 58;
+    return part1(test_cubes) == 64
+        && part2(test_cubes) == 58;
 };
 static_assert(test());
 
+/*
+ * Lava spread over many bricks: a hollow 40^3 shell, whose inside contains a
+ * whole empty brick, and next to it a solid block with a two-voxel air pocket
+ * straddling the brick boundary at x = 48
+ */
+auto multi_brick_cubes = [] {
+    cubes_t cubes;
+    for (int z = 0; z < 40; z++) {
+        for (int y = 0; y < 40; y++) {
+            for (int x = 0; x < 40; x++) {
+                auto const on_edge = [](int i) { return i == 0 || i == 39; };
+                if (on_edge(x) || on_edge(y) || on_edge(z)) {
+                    cubes.push_back({x, y, z});
+                }
+            }
+        }
+    }
+    for (int z = 5; z <= 10; z++) {
+        for (int y = 5; y <= 10; y++) {
+            for (int x = 44; x <= 55; x++) {
+                if (!(y == 7 && z == 7 && (x == 47 || x == 48))) {
+                    cubes.push_back({x, y, z});
+                }
+            }
+        }
+    }
+    return cubes;
+};
+
+// Check that the sparse representation gives the same answers as the dense
+// one, even when the cubes are a long way from the origin
+auto test_sparse = [] {
+    auto const far = [](cubes_t const& cubes) {
+        return flux::ref(cubes)
+                .map([](vec3 c) { return c + vec3{-1'000'000'000, 5'000'000, 123}; })
+                .to<cubes_t>();
+    };
+
+    auto const matches_dense = [&](cubes_t const& cubes, std::int64_t area, std::int64_t exterior) {
+        auto const grid = make_grid(cubes);
+        if (surface_area(grid) != area || exterior_area(grid) != exterior) {
+            return false;
+        }
+        return flux::all(std::array{cubes, far(cubes)}, [&](cubes_t const& c) {
+            auto const sparse = make_sparse(c);
+            return surface_area(sparse) == area && exterior_area(sparse) == exterior;
+        });
+    };
+
+    // The shell's outside and inside, then the block's outside and pocket
+    return matches_dense(parse_input(test_data), 64, 58)
+        && matches_dense(multi_brick_cubes(), 6 * 40 * 40 + 6 * 38 * 38 + 360 + 10, 6 * 40 * 40 + 360);
+};
+
+/*
+ * Generates a random n*n*n volume of lava (with roughly one voxel in four
+ * filled) and times both parts on it
+ */
+auto benchmark = [](int n) {
+    using word_t = voxel_grid::word_t;
+
+    aoc::timer t;
+    auto grid = voxel_grid(vec3{-1, -1, -1}, vec3{n + 2, n + 2, n + 2});
+    std::mt19937_64 gen(18);
+
+    for (int z = 1; z <= n; z++) {
+        for (int y = 1; y <= n; y++) {
+            auto* row = grid.row(y, z);
+            for (int i = 0; i < grid.row_words; i++) {
+                row[i] = gen() & gen();
+            }
+            // Keep the border clear
+            row[0] &= ~word_t{1};
+            int const last = n + 1;
+            row[last / voxel_grid::word_bits] &= (word_t{1} << (last % voxel_grid::word_bits)) - 1;
+        }
+    }
+    fmt::print("Generated {}^3 voxels in {}\n", n, t.elapsed<std::chrono::milliseconds>());
+
+    t.reset();
+    auto const area = surface_area(grid);
+    fmt::print("Surface area: {} ({})\n", area, t.elapsed<std::chrono::milliseconds>());
+
+    t.reset();
+    auto const exterior = exterior_area(grid);
+    fmt::print("Exterior area: {} ({})\n", exterior, t.elapsed<std::chrono::milliseconds>());
+};
+
 int main(int argc, char** argv)
 {
+    assert(test_sparse());
+
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(500);
+        return 0;
+    }
+
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
         return -1;
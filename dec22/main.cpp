@@ -2,6 +2,7 @@
 #include "../common.hpp"
 
 #include <cassert>
+#include <random>
 
 struct vec2 {
     int x = 0;
@@ -55,7 +56,10 @@ auto parse_input = [](std::string_view input) -> std::pair<grid_t, std::vector<i
 {
     auto nl = input.find("\n\n");
 
-    grid_t grid = flux::split(input.substr(0, nl), '\n').to<grid_t>();
+    grid_t grid;
+    flux::split_string(input.substr(0, nl), '\n').for_each([&](std::string_view line) {
+        grid.emplace_back(line);
+    });
     // Make sure each line has the same length
     auto max_len = flux::map(std::ref(grid), flux::size).max().value();
     for (auto& str : grid) {
@@ -92,10 +96,10 @@ struct state_t {
     direction dir;
 };
 
+constexpr vec2 offsets[] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+
 auto next_state_p1 = [](grid_t const& grid, state_t state) -> state_t
 {
-    constexpr vec2 offsets[] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
-
     auto in_bounds = [&grid](vec2 p) {
         return p.y >= 0 && p.y < (int) grid.size() && p.x >= 0 && p.x < (int) grid.at(p.y).size();
     };
@@ -122,180 +126,309 @@ auto next_state_p1 = [](grid_t const& grid, state_t state) -> state_t
     return {pos, dir};
 };
 
-
 /*
- My layout:
-  AB
-  C
- DE
- F
-*/
-constexpr int face_sz = 50;
-
-template <int I, int J>
-auto in = [](vec2 pos) {
-    return pos.x >= I * face_sz &&
-           pos.x < (I + 1) * face_sz &&
-           pos.y >= J * face_sz &&
-           pos.y < (J + 1) * face_sz;
+ * Cube folding
+ *
+ * To fold the net, we give each face a frame made up of three unit vectors:
+ * its outward normal, and the directions in which "right" and "down" on the
+ * map point once the face has been folded into place. Starting from an
+ * arbitrary face, we walk across the net; each time we step onto a new face
+ * we can work out its frame by rotating the old one around the shared edge.
+ *
+ * Once every face has a frame, the face on the other side of an edge is the
+ * one whose normal points in the direction we were travelling, and our new
+ * direction of travel is the opposite of the old face's normal. From that we
+ * build a table with an entry for every tile along every edge of every face,
+ * so that the walker just needs a lookup whenever it steps off a face.
+ */
+struct vec3 {
+    int x = 0, y = 0, z = 0;
+
+    friend auto operator==(vec3, vec3) -> bool = default;
+
+    friend constexpr auto operator-(vec3 v) -> vec3 {
+        return {-v.x, -v.y, -v.z};
+    }
+};
+
+struct frame {
+    vec3 normal;
+    vec3 right;
+    vec3 down;
+
+    // The direction on the cube that a given direction on the map points to
+    constexpr auto towards(direction dir) const -> vec3 {
+        switch (dir) {
+        case direction::right: return right;
+        case direction::down: return down;
+        case direction::left: return -right;
+        case direction::up: return -down;
+        }
+        return {};
+    }
+
+    // The frame of the face on the other side of the edge in direction dir
+    constexpr auto fold(direction dir) const -> frame {
+        switch (dir) {
+        case direction::right: return {right, -normal, down};
+        case direction::down: return {down, right, -normal};
+        case direction::left: return {-right, normal, down};
+        case direction::up: return {-down, right, normal};
+        }
+        return {};
+    }
+};
+
+constexpr auto is_horizontal = [](direction dir) {
+    return dir == direction::right || dir == direction::left;
 };
 
-auto in_A = in<1, 0>;
-auto in_B = in<2, 0>;
-auto in_C = in<1, 1>;
-auto in_D = in<0, 2>;
-auto in_E = in<1, 2>;
-auto in_F = in<0, 3>;
+struct cube_map {
+    int face_sz = 0;
+    int faces_across = 0;
+    std::vector<vec2> faces; // top-left corner of each face on the map
+    std::vector<int> face_index; // face at each (x, y) of the net, or -1
+    std::vector<state_t> wraps; // indexed by [face][direction][position along edge]
 
+    constexpr auto face_of(vec2 pos) const -> int {
+        return face_index.at((pos.y / face_sz) * faces_across + pos.x / face_sz);
+    }
 
-auto next_state_p2 = [](grid_t const&, state_t state) -> state_t
+    constexpr auto wrap(int face, direction dir, int along) const -> state_t {
+        return wraps.at((face * 4 + static_cast<int>(dir)) * face_sz + along);
+    }
+
+    constexpr auto next(state_t state) const -> state_t
+    {
+        auto [pos, dir] = state;
+        int const face = face_of(pos);
+        vec2 const local{pos.x - faces[face].x, pos.y - faces[face].y};
+        vec2 const next_local = local + offsets[static_cast<int>(dir)];
+
+        if (next_local.x >= 0 && next_local.x < face_sz &&
+            next_local.y >= 0 && next_local.y < face_sz) {
+            return {pos + offsets[static_cast<int>(dir)], dir};
+        }
+
+        return wrap(face, dir, is_horizontal(dir) ? local.y : local.x);
+    }
+};
+
+auto fold_cube = [](grid_t const& grid) -> cube_map
 {
-    constexpr vec2 offsets[] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+    cube_map cube;
 
-    auto [old_pos, dir] = state;
+    int const n_tiles = flux::ref(grid)
+                            .map([](auto const& row) { return flux::count_if(row, [](char c) { return c != ' '; }); })
+                            .sum();
+    while (6 * (cube.face_sz + 1) * (cube.face_sz + 1) <= n_tiles) {
+        ++cube.face_sz;
+    }
+    int const face_sz = cube.face_sz;
+    assert(6 * face_sz * face_sz == n_tiles);
+
+    int const faces_down = (grid.size() + face_sz - 1) / face_sz;
+    cube.faces_across = (grid.at(0).size() + face_sz - 1) / face_sz;
+    cube.face_index.assign(faces_down * cube.faces_across, -1);
+
+    for (int j = 0; j < faces_down; j++) {
+        for (int i = 0; i < cube.faces_across; i++) {
+            vec2 const corner{i * face_sz, j * face_sz};
+            if (corner.x < (int) grid.at(corner.y).size() && at(grid, corner) != ' ') {
+                cube.face_index.at(j * cube.faces_across + i) = cube.faces.size();
+                cube.faces.push_back(corner);
+            }
+        }
+    }
+    assert(cube.faces.size() == 6);
+
+    // Walk across the net, folding as we go
+    std::vector<std::optional<frame>> frames(6);
+    frames[0] = frame{.normal = {0, 0, 1}, .right = {1, 0, 0}, .down = {0, 1, 0}};
+    std::vector<int> stack{0};
+
+    while (!stack.empty()) {
+        int const face = stack.back();
+        stack.pop_back();
+
+        for (int d = 0; d < 4; d++) {
+            vec2 const neighbour = cube.faces[face] + vec2{offsets[d].x * face_sz, offsets[d].y * face_sz};
+            if (neighbour.x < 0 || neighbour.y < 0 ||
+                neighbour.x >= cube.faces_across * face_sz || neighbour.y >= faces_down * face_sz) {
+                continue;
+            }
+            int const idx = cube.face_of(neighbour);
+            if (idx >= 0 && !frames[idx]) {
+                frames[idx] = frames[face]->fold(direction{d});
+                stack.push_back(idx);
+            }
+        }
+    }
 
-    vec2 offset = offsets[static_cast<int>(dir)];
-    vec2 pos = old_pos + offset;
-
-    if (in<1, -1>(pos) && in_A(old_pos)) { // up off face A, -> left of face F
-        assert(dir == direction::up);
-        pos = {0, pos.x + 2 * face_sz};
-        dir = direction::right;
-        assert(in_F(pos));
-    } else if (in<0, 0>(pos) && in_A(old_pos)) { // left off face A -> left of face D
-        assert(dir == direction::left);
-        pos = {0, 3 * face_sz - pos.y - 1};
-        dir = direction::right;
-        assert(in_D(pos));
-    } else if (in<2, -1>(pos) && in_B(old_pos)) { // up off face B, -> bottom of face F
-        //fmt::print("  B -> F\n");
-        assert(dir == direction::up);
-        pos = {pos.x - 2 * face_sz, 4 * face_sz - 1};
-        dir = direction::up; // ?!
-        assert(in_F(pos));
-    } else if (in<3, 0>(pos) && in_B(old_pos)) { // right off face B, -> right of face E
-        assert(dir == direction::right);
-        pos = {2 * face_sz - 1, 3 * face_sz - pos.y - 1};
-        dir = direction::left;
-        assert(in_E(pos));
-    } else if (in<2, 1>(pos) && in_B(old_pos)) { // down off face B, -> right of face C
-        assert(dir == direction::down);
-        pos = {2 * face_sz - 1, pos.x - face_sz};
-        dir = direction::left;
-        assert(in_C(pos));
-    } else if (in<0, 1>(pos) && in_C(old_pos)) { // left off face C, -> top of face D
-        assert(dir == direction::left);
-        pos = {pos.y - face_sz, 2 * face_sz};
-        dir = direction::down;
-        assert(in_D(pos));
-    } else if (in<2, 1>(pos) && in_C(old_pos)) { // right off face C -> bottom of face B
-        //fmt::print("  C -> B\n");
-        assert(dir == direction::right);
-        pos = {pos.y + face_sz, face_sz - 1};
-        dir = direction::up;
-        assert(in_B(pos));
-    } else if (in<0, 1>(pos) && in_D(old_pos)) { // up off face D, -> left of face C
-        assert(dir == direction::up);
-        pos = {face_sz, face_sz + pos.x};
-        dir = direction::right;
-        assert(in_C(pos));
-    } else if (in<-1, 2>(pos) && in_D(old_pos)) { // left off face D -> left of face A
-        assert(dir == direction::left);
-        pos = {face_sz, 3 * face_sz - pos.y - 1};
-        dir = direction::right;
-        assert(in_A(pos));
-    } else if (in<2, 2>(pos) && in_E(old_pos)) { // right off face E, -> right of face B
-        assert(dir == direction::right);
-        pos = {3 * face_sz - 1, 3 * face_sz - pos.y - 1};
-        dir = direction::left;
-        assert(in_B(pos));
-    } else if (in<1, 3>(pos) && in_E(old_pos)) { // down off face E, -> right of face F
-        assert(dir == direction::down);
-        pos = {face_sz - 1, pos.x + 2 * face_sz}; // ???
-        dir = direction::left;
-        assert(in_F(pos));
-    } else if (in<1, 3>(pos) && in_F(old_pos)) { // right off face F, -> bottom of face E
-        assert(dir == direction::right);
-        pos = {pos.y - 2 * face_sz, 3 * face_sz - 2};
-        dir = direction::up;
-        assert(in_E(pos));
-    } else if (in<-1, 3>(pos) && in_F(old_pos)) { // left off face F, -> top of face A
-        assert(dir == direction::left);
-        pos = {pos.y - 2 * face_sz, 0};
-        dir = direction::down;
-        assert(in_A(pos));
-    } else if (in<0, 4>(pos) && in_F(old_pos)) { // down off face F, -> top of face B
-        assert(dir == direction::down);
-        pos = {pos.x + 2 * face_sz, 0};
-        dir = direction::down; // !!
-        assert(in_B(pos));
+    // Now work out where we end up when stepping off each edge
+    cube.wraps.resize(6 * 4 * face_sz);
+
+    for (int face = 0; face < 6; face++) {
+        frame const& from = *frames[face];
+
+        for (int d = 0; d < 4; d++) {
+            auto const dir = direction{d};
+            vec3 const heading = from.towards(dir);
+
+            int const target = flux::ints(0, 6).find_if([&](auto f) { return frames[f]->normal == heading; });
+            frame const& to = *frames[target];
+
+            auto const new_dir = direction(flux::ints(0, 4).find_if([&](auto nd) {
+                return to.towards(direction(nd)) == -from.normal;
+            }));
+
+            // The vector running along the shared edge, as seen from each face
+            vec3 const along_from = is_horizontal(dir) ? from.down : from.right;
+            vec3 const along_to = is_horizontal(new_dir) ? to.down : to.right;
+            bool const flip = along_from != along_to;
+
+            for (int t = 0; t < face_sz; t++) {
+                int const t2 = flip ? face_sz - 1 - t : t;
+                vec2 local{};
+                switch (new_dir) {
+                case direction::right: local = {0, t2}; break;
+                case direction::down: local = {t2, 0}; break;
+                case direction::left: local = {face_sz - 1, t2}; break;
+                case direction::up: local = {t2, face_sz - 1}; break;
+                }
+
+                cube.wraps.at((face * 4 + d) * face_sz + t) = state_t{cube.faces[target] + local, new_dir};
+            }
+        }
     }
 
-    return {pos, dir};
+    return cube;
 };
 
-auto test_stuff = [] {
-    constexpr grid_t g{};
+/*
+ * Jump tables
+ *
+ * Every move can be undone by turning around and moving back, so each state
+ * (position and direction) has at most one predecessor as well as at most
+ * one successor. That means the states split up into disjoint chains, each
+ * of which either ends when the next step would hit a wall, or loops back on
+ * itself. If we lay out every chain contiguously, moving N steps is just a
+ * matter of adding N to our index within the chain, clamping at the end (or
+ * wrapping around for a loop).
+ */
+struct jump_table {
+    struct chain {
+        int begin = 0;
+        int length = 0;
+        bool cyclic = false;
+    };
 
-    auto test_all_dirs = [&](vec2 pos) {
-        next_state_p2(g, {pos, direction::up});
-        next_state_p2(g, {pos, direction::right});
-        next_state_p2(g, {pos, direction::down});
-        next_state_p2(g, {pos, direction::left});
+    struct entry {
+        int chain = -1;
+        int offset = -1; // where the state is in `states`
     };
 
-    auto test_all_corners = [&](vec2 top_left) {
-        auto [x, y] = top_left;
-        constexpr auto block = face_sz - 1;
-        test_all_dirs({x, y});
-        test_all_dirs({x + block, y});
-        test_all_dirs({x, y + block});
-        test_all_dirs({x + block, y + block});
+    int width = 0;
+    std::vector<state_t> states; // all the chains, laid out end to end
+    std::vector<entry> entries; // indexed by state index
+    std::vector<chain> chains;
+
+    constexpr auto index(state_t s) const -> int {
+        return (s.pos.y * width + s.pos.x) * 4 + static_cast<int>(s.dir);
+    }
+
+    constexpr auto move(state_t s, int dist) const -> state_t {
+        auto const [chain_idx, offset] = entries[index(s)];
+        auto const& c = chains[chain_idx];
+        std::int64_t i = offset - c.begin;
+        i = c.cyclic ? (i + dist) % c.length : std::min<std::int64_t>(i + dist, c.length - 1);
+        return states[c.begin + i];
+    }
+};
+
+auto build_jump_table = [](grid_t const& grid, auto const& next_fn) -> jump_table
+{
+    jump_table table;
+    table.width = grid.at(0).size();
+    int const n_states = table.width * grid.size() * 4;
+
+    auto state_at = [&](int idx) {
+        return state_t{{(idx / 4) % table.width, (idx / 4) / table.width}, direction(idx % 4)};
     };
 
-    // corners of A
-    test_all_corners({face_sz, 0});
+    auto is_open = [&](int idx) { auto s = state_at(idx); return at(grid, s.pos) == '.'; };
 
-    // Corners of B
-    test_all_corners({2 * face_sz, 0});
+    std::vector<int> succ(n_states, -1);
+    std::vector<bool> has_pred(n_states, false);
 
-    // Corners of C
-    test_all_corners({face_sz, face_sz});
+    for (int idx = 0; idx < n_states; idx++) {
+        if (is_open(idx)) {
+            auto next = next_fn(state_at(idx));
+            if (at(grid, next.pos) == '.') {
+                succ[idx] = table.index(next);
+                has_pred[succ[idx]] = true;
+            }
+        }
+    }
 
-    // Corners of D
-    test_all_corners({0, 2 * face_sz});
+    table.entries.assign(n_states, {});
 
-    // Corners of E
-    test_all_corners({face_sz, 2 * face_sz});
+    auto add_chain = [&](int head, bool cyclic) {
+        int const id = table.chains.size();
+        jump_table::chain c{.begin = (int) table.states.size(), .cyclic = cyclic};
+
+        for (int idx = head; idx != -1 && table.entries[idx].chain == -1; idx = succ[idx]) {
+            table.entries[idx] = {.chain = id, .offset = (int) table.states.size()};
+            table.states.push_back(state_at(idx));
+        }
+
+        c.length = table.states.size() - c.begin;
+        table.chains.push_back(c);
+    };
+
+    // First the chains which end at a wall: these start at states which have
+    // no predecessor. Whatever is left over must be a loop.
+    for (int idx = 0; idx < n_states; idx++) {
+        if (is_open(idx) && !has_pred[idx]) {
+            add_chain(idx, false);
+        }
+    }
+    for (int idx = 0; idx < n_states; idx++) {
+        if (is_open(idx) && table.entries[idx].chain == -1) {
+            add_chain(idx, true);
+        }
+    }
 
-    // Corners of F
-    test_all_corners({0, 3 * face_sz});
+    return table;
+};
 
-    return true;
+// Moves one tile at a time, for comparison with the jump table
+auto step_by_step = [](grid_t const& grid, auto const& next_fn) {
+    return [&grid, next_fn](state_t s, int dist) {
+        while (dist-- > 0) {
+            state_t next = next_fn(s);
+            if (at(grid, next.pos) == '#') {
+                break;
+            }
+            assert(at(grid, next.pos) == '.');
+            s = next;
+        }
+        return s;
+    };
 };
-static_assert(test_stuff());
 
-template <auto& NextFn>
-auto walk = [](grid_t const& grid, std::vector<int> instructions) -> int
+auto walk = [](grid_t const& grid, std::vector<int> const& instructions, auto const& move_fn) -> int
 {
     state_t state{
         .pos = {(int) grid.at(0).find('.'), 0},
         .dir = direction::right
     };
 
-    state = flux::fold(instructions, [&grid](state_t s, int instr) {
+    state = flux::fold(instructions, [&](state_t s, int instr) {
         switch (instr) {
         case go_left: turn_left(s.dir); break;
         case go_right: turn_right(s.dir); break;
-        default:
-            while (instr-- > 0) {
-                state_t next = NextFn(grid, s);
-                if (at(grid, next.pos) == '#') {
-                    break;
-                }
-                assert(at(grid, next.pos) == '.');
-                s = next;
-            }
+        default: s = move_fn(s, instr);
         }
         return s;
     }, std::move(state));
@@ -307,9 +440,16 @@ auto walk = [](grid_t const& grid, std::vector<int> instructions) -> int
            + static_cast<int>(state.dir);
 };
 
-auto part1 = walk<next_state_p1>;
+auto part1 = [](grid_t const& grid, std::vector<int> const& instructions) {
+    auto const table = build_jump_table(grid, [&grid](state_t s) { return next_state_p1(grid, s); });
+    return walk(grid, instructions, [&table](state_t s, int dist) { return table.move(s, dist); });
+};
 
-auto part2 = walk<next_state_p2>;
+auto part2 = [](grid_t const& grid, std::vector<int> const& instructions) {
+    auto const cube = fold_cube(grid);
+    auto const table = build_jump_table(grid, [&cube](state_t s) { return cube.next(s); });
+    return walk(grid, instructions, [&table](state_t s, int dist) { return table.move(s, dist); });
+};
 
 constexpr auto test_input =
 R"(        ...#
@@ -328,11 +468,123 @@ R"(        ...#
 10R5L5R10L4R5L5
 )";
 
+auto test = [] {
+    auto const [grid, instr] = parse_input(test_input);
+    return part1(grid, instr) == 6032
+        && part2(grid, instr) == 5031;
+};
+static_assert(test());
+
+// The eleven distinct nets of a cube, with each face shrunk to a single tile
+constexpr std::string_view nets[] = {
+    "#   \n####\n#   ", "#   \n####\n #  ", "#   \n####\n  # ", "#   \n####\n   #",
+    " #  \n####\n #  ", " #  \n####\n  # ",
+    "##  \n ###\n #  ", "##  \n ###\n  # ", "##  \n ###\n   #",
+    "##  \n ## \n  ##",
+    "###  \n  ###"
+};
+
+// For every net, check that stepping off any edge and then turning around
+// takes us back where we started, and that crossing an edge which is
+// already joined on the map is just a normal step
+auto test_nets = [] {
+    constexpr int sz = 3;
+
+    auto opposite = [](direction d) { return direction{(static_cast<int>(d) + 2) % 4}; };
+
+    return flux::all(nets, [&](std::string_view net) {
+        grid_t grid;
+        flux::split_string(net, '\n').for_each([&](std::string_view line) {
+            std::string row;
+            for (char c : line) {
+                row.append(sz, c == '#' ? '.' : ' ');
+            }
+            grid.insert(grid.end(), sz, row);
+        });
+
+        auto const cube = fold_cube(grid);
+
+        for (int face = 0; face < 6; face++) {
+            for (int d = 0; d < 4; d++) {
+                for (int t = 0; t < sz; t++) {
+                    auto const dir = direction{d};
+                    auto const [pos, new_dir] = cube.wrap(face, dir, t);
+
+                    auto const back = cube.next({pos, opposite(new_dir)});
+                    if (cube.face_of(back.pos) != face || back.dir != opposite(dir) ||
+                        cube.next({back.pos, dir}).pos != pos) {
+                        return false;
+                    }
+
+                    vec2 const corner = cube.faces[face];
+                    vec2 const local = is_horizontal(dir) ? vec2{d == 0 ? sz - 1 : 0, t}
+                                                          : vec2{t, d == 1 ? sz - 1 : 0};
+                    vec2 const stepped = corner + local + offsets[d];
+                    if (stepped.x >= 0 && stepped.y >= 0 && stepped.y < (int) grid.size() &&
+                        stepped.x < (int) grid[stepped.y].size() && at(grid, stepped) != ' ') {
+                        if (pos != stepped || new_dir != dir) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    });
+};
+static_assert(test_nets());
+
+/*
+ * Generates a large cube map and a long list of instructions, and times
+ * walking it with and without the jump tables
+ */
+auto benchmark = [](int face_sz, int n_moves) {
+    std::mt19937 gen(22);
+    auto random_tile = [&] { return std::uniform_int_distribution(0, 999)(gen) < 5 ? '#' : '.'; };
+
+    // Same layout as the real input
+    constexpr std::string_view layout[] = { " ##", " # ", "## ", "#  " };
+    grid_t grid;
+    for (auto line : layout) {
+        for (int y = 0; y < face_sz; y++) {
+            std::string row;
+            for (char c : line) {
+                for (int x = 0; x < face_sz; x++) {
+                    row += c == '#' ? random_tile() : ' ';
+                }
+            }
+            grid.push_back(std::move(row));
+        }
+    }
+    grid[0][face_sz] = '.';
+
+    std::vector<int> instructions;
+    for (int i = 0; i < n_moves; i++) {
+        instructions.push_back(std::uniform_int_distribution(1, 4 * face_sz)(gen));
+        instructions.push_back(i % 3 == 0 ? go_left : go_right);
+    }
+
+    fmt::print("Face size {}, {} moves\n", face_sz, n_moves);
+
+    auto const cube = fold_cube(grid);
+    auto const next_fn = [&cube](state_t s) { return cube.next(s); };
+
+    aoc::timed("step by step", [&] { return walk(grid, instructions, step_by_step(grid, next_fn)); });
+
+    aoc::timer t;
+    auto const table = build_jump_table(grid, next_fn);
+    fmt::print("building jump table: {}\n", t.elapsed<std::chrono::milliseconds>());
+
+    aoc::timed("with jump table", [&] {
+        return walk(grid, instructions, [&table](state_t s, int dist) { return table.move(s, dist); });
+    });
+};
+
 int main(int argc, char** argv)
 {
-    {
-        auto [grid, instr] = parse_input(test_input);
-        fmt::print("Part 1 test: {}\n", part1(grid, instr));
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        benchmark(1000, 2'000'000);
+        return 0;
     }
 
     if (argc < 2) {
@@ -1,7 +1,10 @@
 
 #include "../common.hpp"
 
-#include <set>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <thread>
 
 namespace {
 
@@ -22,7 +25,73 @@ struct vec2 {
     }
 };
 
-auto parse_input = [](std::string_view input) -> std::vector<vec2> {
+/*
+ * The elves are stored as a bitboard: each row of the grid is a run of
+ * 64-bit words, with bit (x % 64) of word (x / 64) representing column x.
+ * This lets us compute the proposals and resolve collisions for 64 elves
+ * at a time using shifts and masks.
+ *
+ * We always keep an empty border (the first and last row, and the first and
+ * last column) around the elves, so that nobody can ever step off the edge
+ * of the board. If an elf wanders into the border, we grow the board.
+ */
+struct board {
+    using word_t = std::uint64_t;
+    static constexpr int word_bits = 64;
+
+    int width = 0; // in words
+    int height = 0; // in rows
+    std::vector<word_t> bits;
+
+    constexpr auto row(int y) -> word_t* { return bits.data() + y * width; }
+    constexpr auto row(int y) const -> word_t const* { return bits.data() + y * width; }
+
+    constexpr auto test(vec2 p) const -> bool {
+        return (row(p.y)[p.x / word_bits] >> (p.x % word_bits)) & 1;
+    }
+
+    constexpr void set(vec2 p) {
+        row(p.y)[p.x / word_bits] |= word_t{1} << (p.x % word_bits);
+    }
+
+    friend auto operator==(board const&, board const&) -> bool = default;
+};
+
+/*
+ * Shift an entire row by N bits, carrying between words.
+ * Bit x of from_west<N>(row, i) is bit (x - N) of the row, i.e. it tells
+ * us whether there is something N places to the west of x. Similarly,
+ * from_east<N> tells us whether there is something N places to the east.
+ */
+template <int N>
+constexpr auto from_west = [](board::word_t const* row, int i) -> board::word_t {
+    return (row[i] << N) | (i > 0 ? row[i - 1] >> (board::word_bits - N) : 0);
+};
+
+template <int N>
+constexpr auto from_east = [](board::word_t const* row, int i, int width) -> board::word_t {
+    return (row[i] >> N) | (i + 1 < width ? row[i + 1] << (board::word_bits - N) : 0);
+};
+
+auto make_board = [](std::vector<vec2> const& elves, int pad_x, int pad_y) -> board {
+    auto [min_x, max_x] = flux::map(std::cref(elves), &vec2::x).minmax().value();
+    auto [min_y, max_y] = flux::map(std::cref(elves), &vec2::y).minmax().value();
+
+    int const cols = (max_x - min_x + 1) + 2 * pad_x;
+
+    board b;
+    b.width = (cols + board::word_bits - 1) / board::word_bits;
+    b.height = (max_y - min_y + 1) + 2 * pad_y;
+    b.bits.resize(b.width * b.height);
+
+    for (vec2 elf : elves) {
+        b.set({elf.x - min_x + pad_x, elf.y - min_y + pad_y});
+    }
+
+    return b;
+};
+
+auto parse_input = [](std::string_view input) -> board {
     int x = 0; int y = 0;
     std::vector<vec2> elves;
     for (char c : input) {
@@ -32,110 +101,264 @@ auto parse_input = [](std::string_view input) -> std::vector<vec2> {
         default: ++x;
         }
     }
-    flux::sort(elves);
-    return elves;
+    return make_board(elves, 1, 1);
 };
 
-auto contains = [](auto const& elves, vec2 pos) -> bool {
-    return std::ranges::binary_search(elves, pos);
+auto to_positions = [](board const& b) -> std::vector<vec2> {
+    std::vector<vec2> out;
+    for (int y = 0; y < b.height; y++) {
+        for (int i = 0; i < b.width; i++) {
+            for (auto w = b.row(y)[i]; w != 0; w &= w - 1) {
+                out.push_back({i * board::word_bits + std::countr_zero(w), y});
+            }
+        }
+    }
+    return out;
 };
 
-auto get_neighbours = [](vec2 p) {
-    return flux::from(std::array<vec2, 8>{
-        vec2{p.x - 1, p.y - 1}, {p.x, p.y - 1}, {p.x + 1, p.y - 1},
-            {p.x - 1, p.y    },                 {p.x + 1, p.y    },
-            {p.x - 1, p.y + 1}, {p.x, p.y + 1}, {p.x + 1, p.y + 1}
-    });
-};
+// Make sure that nobody is standing in the border, growing the board if necessary
+auto ensure_border = [](board& b) {
+    constexpr auto high_bit = board::word_t{1} << (board::word_bits - 1);
 
-constexpr int indices_map[][3] = {
-    /*north = */{0, 1, 2},
-    /*south = */{5, 6, 7},
-    /*west  = */{0, 3, 5},
-    /*east  = */{2, 4, 7}
-};
+    bool const touching =
+        flux::any(std::span(b.row(0), b.width), [](auto w) { return w != 0; }) ||
+        flux::any(std::span(b.row(b.height - 1), b.width), [](auto w) { return w != 0; }) ||
+        flux::ints(0, b.height).any([&](int y) {
+            return (b.row(y)[0] & 1) || (b.row(y)[b.width - 1] & high_bit);
+        });
 
-constexpr vec2 directions_map[] = {
-    /*north = */{0 , -1},
-    /*south = */{0 ,  1},
-    /*west  = */{-1,  0},
-    /*east  = */{1 , 0 }
+    if (touching) {
+        // Grow generously so that we don't need to do this every round
+        b = make_board(to_positions(b), board::word_bits, std::max(8, b.height / 4));
+    }
 };
 
-auto unique_copy = [](std::vector<vec2> vec) {
-    flux::sort(vec);
-    std::vector<vec2> out;
-    out.reserve(vec.size());
+/*
+ * Calls fn(band, begin, end) for n_threads contiguous bands of the rows
+ * [0, n_rows), running each band on its own thread. Returns once all bands
+ * are complete.
+ */
+auto for_each_band = [](int n_rows, int n_threads, auto const& fn) {
+    if (n_threads <= 1 || std::is_constant_evaluated()) {
+        fn(0, 0, n_rows);
+        return;
+    }
+
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < n_threads; t++) {
+        workers.emplace_back(fn, t, (n_rows * t) / n_threads, (n_rows * (t + 1)) / n_threads);
+    }
+};
 
-    auto seq = flux::ref(vec);
-    auto idx = seq.first();
+// The bounding box is in board coordinates, which change when the board grows
+struct round_stats {
+    int moved = 0;
+    vec2 min{std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    vec2 max{std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
 
-    while (!seq.is_last(idx)) {
-        auto next = flux::slice(seq, seq.next(idx), flux::last).find_if([p1=seq[idx]](vec2 p2) { return p1 != p2; });
-        if (next == seq.next(idx)) {
-            out.push_back(seq[idx]);
-        }
-        idx = next;
+    constexpr auto area() const -> int {
+        return ((1 + max.x) - min.x) * ((1 + max.y) - min.y);
     }
 
-    return out;
+    constexpr auto merge(round_stats const& other) -> round_stats& {
+        moved += other.moved;
+        min = {std::min(min.x, other.min.x), std::min(min.y, other.min.y)};
+        max = {std::max(max.x, other.max.x), std::max(max.y, other.max.y)};
+        return *this;
+    }
 };
 
-auto round = [](std::vector<vec2> elves, int starting_dir) {
+/*
+ * Each round is done in two passes, each of which only reads the output of
+ * the previous one: first we work out every elf's proposal, and then we
+ * resolve the proposals into the new board. Within a pass each row depends
+ * only on a few neighbouring rows (one on either side for the proposals,
+ * two for the resolution), so we can split the rows into bands and process
+ * them concurrently, with results identical to the serial version.
+ *
+ * The simulation owns all of its buffers and swaps between two boards, so
+ * that stepping doesn't allocate unless the board needs to grow.
+ */
+struct simulation {
+    using word_t = board::word_t;
+
+    board elves;
+    int round_no = 0;
+
+    constexpr explicit simulation(board initial)
+        : elves(std::move(initial))
+    {}
+
+    constexpr auto step(int n_threads = 1) -> round_stats
+    {
+        ensure_border(elves);
+        // Compare the shape, not just the word count: propose() never writes
+        // the border rows of props_, so they must be re-zeroed whenever the
+        // rows move, even if the board ends up the same size
+        if (next_.width != elves.width || next_.height != elves.height) {
+            next_ = board{.width = elves.width, .height = elves.height,
+                          .bits = std::vector<word_t>(elves.bits.size())};
+            for (auto& p : props_) {
+                p.assign(elves.bits.size(), 0);
+            }
+        }
+
+        band_stats_.assign(std::max(n_threads, 1), round_stats{});
 
-    std::vector<vec2> proposed_moves = flux::map(std::cref(elves), [&](vec2 elf) -> vec2 {
-        std::array<bool, 8> occupied{};
-        get_neighbours(elf)
-            .map([&elves](vec2 p) { return contains(elves, p); })
-            .output_to(occupied.begin());
+        propose(n_threads);
+        resolve(n_threads);
 
-        if (flux::any(occupied, std::identity{})) {
-            for (int i = 0; i < 4; i++) {
-                auto dir = (starting_dir + i) % 4;
+        std::swap(elves, next_);
+        ++round_no;
 
-                if (flux::none(indices_map[dir], [&](int i) { return occupied[i]; })) {
-                    return  elf + directions_map[dir];
+        return flux::fold(band_stats_, [](round_stats acc, round_stats const& s) {
+            return acc.merge(s);
+        }, round_stats{});
+    }
+
+private:
+    board next_;
+    // props_[d] holds the elves which are proposing to move in direction d
+    std::array<std::vector<word_t>, 4> props_;
+    std::vector<round_stats> band_stats_;
+
+    constexpr auto prop_row(int dir, int y) const -> word_t const* {
+        return props_[dir].data() + y * elves.width;
+    }
+
+    constexpr void propose(int n_threads)
+    {
+        int const width = elves.width;
+        int const height = elves.height;
+        int const starting_dir = round_no % 4;
+
+        for_each_band(height, n_threads, [&](int, int y_begin, int y_end) {
+            // The border rows are always empty, so only look at the interior
+            for (int y = std::max(y_begin, 1); y < std::min(y_end, height - 1); y++) {
+                auto const* n = elves.row(y - 1);
+                auto const* c = elves.row(y);
+                auto const* s = elves.row(y + 1);
+
+                for (int i = 0; i < width; i++) {
+                    if (c[i] == 0) {
+                        for (auto& p : props_) {
+                            p[y * width + i] = 0;
+                        }
+                        continue;
+                    }
+
+                    word_t const n_w = from_west<1>(n, i), n_e = from_east<1>(n, i, width);
+                    word_t const c_w = from_west<1>(c, i), c_e = from_east<1>(c, i, width);
+                    word_t const s_w = from_west<1>(s, i), s_e = from_east<1>(s, i, width);
+
+                    std::array<word_t, 4> const free{
+                        /*north = */~(n_w | n[i] | n_e),
+                        /*south = */~(s_w | s[i] | s_e),
+                        /*west  = */~(n_w | c_w | s_w),
+                        /*east  = */~(n_e | c_e | s_e)
+                    };
+
+                    word_t remaining = c[i] & ~(free[0] & free[1] & free[2] & free[3]);
+
+                    for (int d = 0; d < 4; d++) {
+                        auto dir = (starting_dir + d) % 4;
+                        word_t const p = remaining & free[dir];
+                        props_[dir][y * width + i] = p;
+                        remaining &= ~p;
+                    }
                 }
             }
-        }
+        });
+    }
 
-        return elf;
-    }).to<std::vector<vec2>>();
+    // Only elves moving in opposite directions can ever collide: for example
+    // an elf moving north into a cell conflicts exactly with an elf two rows
+    // further north moving south. That means that the arrivals into a cell
+    // are the XOR of the two opposing proposals, and an elf leaves its cell
+    // if its proposal is not matched by the opposing one.
+    constexpr void resolve(int n_threads)
+    {
+        int const width = elves.width;
+        int const height = elves.height;
+
+        for_each_band(height, n_threads, [&](int band, int y_begin, int y_end) {
+            round_stats stats;
+
+            // The proposals for the border rows are always zero, so we can
+            // use them in place of rows which lie off the board
+            auto row_or_zeros = [&](int dir, int y) {
+                return (y >= 0 && y < height) ? prop_row(dir, y) : prop_row(dir, 0);
+            };
+
+            for (int y = y_begin; y < y_end; y++) {
+                auto const* north = prop_row(0, y);
+                auto const* south = prop_row(1, y);
+                auto const* west = prop_row(2, y);
+                auto const* east = prop_row(3, y);
+
+                auto const* north_from_below = row_or_zeros(0, y + 1);
+                auto const* south_from_above = row_or_zeros(1, y - 1);
+                auto const* north_blocked = row_or_zeros(1, y - 2);
+                auto const* south_blocked = row_or_zeros(0, y + 2);
+
+                auto* out = next_.row(y);
+
+                for (int i = 0; i < width; i++) {
+                    word_t const leaving = (north[i] & ~north_blocked[i])
+                                         | (south[i] & ~south_blocked[i])
+                                         | (west[i] & ~from_west<2>(east, i))
+                                         | (east[i] & ~from_east<2>(west, i, width));
+
+                    word_t const arriving = (north_from_below[i] ^ south_from_above[i])
+                                          | (from_east<1>(west, i, width) ^ from_west<1>(east, i));
+
+                    word_t const w = (elves.row(y)[i] & ~leaving) | arriving;
+                    out[i] = w;
+                    stats.moved += std::popcount(leaving);
+
+                    if (w != 0) {
+                        stats.min = {std::min(stats.min.x, i * board::word_bits + std::countr_zero(w)),
+                                     std::min(stats.min.y, y)};
+                        stats.max = {std::max(stats.max.x, (i + 1) * board::word_bits - 1 - std::countl_zero(w)),
+                                     std::max(stats.max.y, y)};
+                    }
+                }
+            }
 
-    std::vector<vec2> unq_moves = unique_copy(proposed_moves);
+            band_stats_[band] = stats;
+        });
+    }
+};
 
-    flux::zip(std::ref(elves), std::cref(proposed_moves))
-        .filter([&](auto p) { auto [_, move] = p; return contains(unq_moves, move); })
-        .for_each([](auto p) { auto [elf, move] = p; elf = move; });
+auto count_elves = [](board const& b) -> int {
+    return flux::ref(b.bits).map([](auto w) { return std::popcount(w); }).sum();
+};
 
-    flux::sort(elves);
+// Don't bother spawning threads unless each one gets a decent amount of work
+constexpr int min_band_rows = 256;
 
-    return elves;
+auto threads_for = [](board const& b, int max_threads) {
+    return std::clamp(b.height / min_band_rows, 1, max_threads);
 };
 
-auto part1 = [](std::vector<vec2> elves) {
-    elves = flux::ints(0, 10).fold([](auto elves, int i) {
-        return round(std::move(elves), i % 4);
-    }, std::move(elves));
+auto part1 = [](board elves, int max_threads = 1) {
+    int const n_elves = count_elves(elves);
+    simulation sim(std::move(elves));
 
-    auto [min_x, max_x] = flux::map(std::cref(elves), &vec2::x).minmax().value();
-    auto [min_y, max_y] = flux::map(std::cref(elves), &vec2::y).minmax().value();
+    round_stats stats;
+    while (sim.round_no < 10) {
+        stats = sim.step(threads_for(sim.elves, max_threads));
+    }
 
-    return ((1 + max_x) - min_x) * ((1 + max_y) - min_y) - flux::size(elves);
+    return stats.area() - n_elves;
 };
 
-auto part2 = [](std::vector<vec2> elves) {
-    int i = 0;
-    while (true) {
-        auto new_elves = round(elves, i % 4);
-        if (elves == new_elves) {
-            break;
-        }
-        elves = std::move(new_elves);
-        ++i;
-    }
+auto part2 = [](board elves, int max_threads = 1) {
+    simulation sim(std::move(elves));
 
-    return i + 1;
+    while (sim.step(threads_for(sim.elves, max_threads)).moved != 0) {}
+
+    return sim.round_no;
 };
 
 constexpr auto& test_input =
@@ -155,16 +378,50 @@ auto test = []{
 };
 static_assert(test());
 
+// Check that splitting a large generated field into bands gives exactly
+// the same results as doing it serially (run with --test)
+auto test_parallel = [] {
+    std::string field;
+    std::uint32_t seed = 12345;
+    for (int y = 0; y < 1000; y++) {
+        for (int x = 0; x < 1000; x++) {
+            seed = seed * 1664525 + 1013904223;
+            field += (seed >> 31) ? '#' : '.';
+        }
+        field += '\n';
+    }
+
+    simulation serial(parse_input(field));
+    simulation parallel = serial;
+
+    for (int i = 0; i < 10; i++) {
+        auto const s1 = serial.step(1);
+        auto const s2 = parallel.step(7);
+        if (s1.moved != s2.moved || s1.area() != s2.area() || serial.elves != parallel.elves) {
+            return false;
+        }
+    }
+    return true;
+};
+
 }
 
 int main(int argc, char** argv)
 {
+    if (argc > 1 && std::string_view(argv[1]) == "--test") {
+        bool const ok = test_parallel();
+        fmt::print("Parallel test {}\n", ok ? "passed" : "FAILED");
+        return ok ? 0 : 1;
+    }
+
     if (argc < 2) {
         fmt::print(stderr, "No input\n");
         return -1;
     }
 
+    int const n_threads = std::max(1u, std::thread::hardware_concurrency());
+
     auto elves = parse_input(aoc::string_from_file(argv[1]));
-    fmt::print("Part 1: {}\n", part1(elves));
-    fmt::print("Part 2: {}\n", part2(elves));
+    fmt::print("Part 1: {}\n", part1(elves, n_threads));
+    fmt::print("Part 2: {}\n", part2(elves, n_threads));
 }
\ No newline at end of file